@@ -1,18 +1,202 @@
+/*
+ * Samples the target's clocks so that traces and measurements taken against
+ * different clocks (ftrace, energy meters, pollers, the host) can be aligned.
+ *
+ * Each sample reads CLOCK_BOOTTIME, CLOCK_MONOTONIC, CLOCK_MONOTONIC_RAW and
+ * CLOCK_REALTIME back to back, followed by a second read of CLOCK_BOOTTIME.
+ * The time between the two CLOCK_BOOTTIME reads is the sample's read window:
+ * the accuracy to which the four clocks are known to correspond. Of all the
+ * samples taken, the one with the smallest window is reported.
+ *
+ * With no options, a single sample is taken and only CLOCK_BOOTTIME is
+ * printed, as "SECONDS.NANOSECONDS".
+ */
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
 
-int main(void) {
-    int ret;
-    struct timespec tp;
+#define NSEC_PER_SEC 1000000000LL
 
-    ret = clock_gettime(CLOCK_BOOTTIME, &tp);
-    if (ret) {
-        perror("clock_gettime()");
-        return EXIT_FAILURE;
+static const char *trace_marker_paths[] = {
+    "/sys/kernel/tracing/trace_marker",
+    "/sys/kernel/debug/tracing/trace_marker",
+};
+
+enum clock_index {
+    BOOTTIME,
+    MONOTONIC,
+    MONOTONIC_RAW,
+    REALTIME,
+    NR_CLOCKS,
+};
+
+static const char *clock_names[NR_CLOCKS] = {
+    "boottime",
+    "monotonic",
+    "monotonic_raw",
+    "realtime",
+};
+
+struct clock_sample {
+    struct timespec clocks[NR_CLOCKS];
+    long long window_ns;
+};
+
+static long long timespec_to_ns(const struct timespec *tp)
+{
+    return tp->tv_sec * NSEC_PER_SEC + tp->tv_nsec;
+}
+
+/* Returns 0 on success, or -1 with errno set. */
+static int take_sample(struct clock_sample *sample)
+{
+    struct timespec end;
+
+    if (clock_gettime(CLOCK_BOOTTIME, &sample->clocks[BOOTTIME]) ||
+        clock_gettime(CLOCK_MONOTONIC, &sample->clocks[MONOTONIC]) ||
+        clock_gettime(CLOCK_MONOTONIC_RAW, &sample->clocks[MONOTONIC_RAW]) ||
+        clock_gettime(CLOCK_REALTIME, &sample->clocks[REALTIME]) ||
+        clock_gettime(CLOCK_BOOTTIME, &end))
+        return -1;
+
+    sample->window_ns = timespec_to_ns(&end) -
+                        timespec_to_ns(&sample->clocks[BOOTTIME]);
+    return 0;
+}
+
+static int open_trace_marker(void)
+{
+    size_t i;
+    int fd;
+
+    for (i = 0; i < sizeof(trace_marker_paths) / sizeof(*trace_marker_paths); i++) {
+        fd = open(trace_marker_paths[i], O_WRONLY);
+        if (fd >= 0)
+            return fd;
+    }
+    return -1;
+}
+
+/*
+ * The marker is written after the sample rather than within it, so that the
+ * write does not widen the read window. Its ftrace timestamp therefore lies
+ * just after the sampled values.
+ */
+static void write_trace_marker(int fd, int index, const struct clock_sample *sample)
+{
+    char buf[256];
+    int len;
+
+    len = snprintf(buf, sizeof(buf),
+                   "clock_sample: index=%d boottime=%lld monotonic=%lld "
+                   "monotonic_raw=%lld realtime=%lld window_ns=%lld\n",
+                   index,
+                   timespec_to_ns(&sample->clocks[BOOTTIME]),
+                   timespec_to_ns(&sample->clocks[MONOTONIC]),
+                   timespec_to_ns(&sample->clocks[MONOTONIC_RAW]),
+                   timespec_to_ns(&sample->clocks[REALTIME]),
+                   sample->window_ns);
+    if (write(fd, buf, len) < 0)
+        perror("write(trace_marker)");
+}
+
+static void print_timespec(const char *name, const struct timespec *tp)
+{
+    if (name)
+        printf("%s=", name);
+    printf("%ld.%09ld\n", (long)tp->tv_sec, tp->tv_nsec);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-a] [-m] [-n SAMPLES]\n"
+            "\n"
+            "    -a          Print all the clocks of the reported sample, as\n"
+            "                NAME=SECONDS.NANOSECONDS lines, followed by its\n"
+            "                window_ns and the sample index.\n"
+            "    -m          Write each sample to the ftrace trace_marker.\n"
+            "    -n SAMPLES  Number of samples to take (default: 1). The\n"
+            "                one with the smallest read window is reported.\n",
+            prog);
+}
+
+int main(int argc, char *argv[])
+{
+    struct clock_sample sample, best;
+    int all_clocks = 0;
+    int marker_fd = -1;
+    int use_marker = 0;
+    int best_index = 0;
+    int nr_samples = 1;
+    int opt;
+    int i;
+
+    memset(&best, 0, sizeof(best));
+
+    while ((opt = getopt(argc, argv, "amn:h")) != -1) {
+        switch (opt) {
+        case 'a':
+            all_clocks = 1;
+            break;
+        case 'm':
+            use_marker = 1;
+            break;
+        case 'n':
+            nr_samples = atoi(optarg);
+            if (nr_samples < 1) {
+                fprintf(stderr, "Invalid number of samples: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'h':
+            usage(argv[0]);
+            return EXIT_SUCCESS;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (use_marker) {
+        marker_fd = open_trace_marker();
+        if (marker_fd < 0) {
+            fprintf(stderr, "Could not open trace_marker: %s\n", strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
+
+    for (i = 0; i < nr_samples; i++) {
+        if (take_sample(&sample)) {
+            perror("clock_gettime()");
+            return EXIT_FAILURE;
+        }
+
+        if (marker_fd >= 0)
+            write_trace_marker(marker_fd, i, &sample);
+
+        if (i == 0 || sample.window_ns < best.window_ns) {
+            best = sample;
+            best_index = i;
+        }
+    }
+
+    if (marker_fd >= 0)
+        close(marker_fd);
+
+    if (!all_clocks) {
+        print_timespec(NULL, &best.clocks[BOOTTIME]);
+        return EXIT_SUCCESS;
     }
 
-    printf("%ld.%ld\n", tp.tv_sec, tp.tv_nsec);
+    for (i = 0; i < NR_CLOCKS; i++)
+        print_timespec(clock_names[i], &best.clocks[i]);
+    printf("window_ns=%lld\n", best.window_ns);
+    printf("sample=%d\n", best_index);
 
     return EXIT_SUCCESS;
 }
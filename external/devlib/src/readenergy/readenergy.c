@@ -20,12 +20,16 @@
  * Reads APB energy registers in Juno and outputs the measurements (converted to appropriate units).
  *
 */
+#define _GNU_SOURCE
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <poll.h>
+#include <sched.h>
 #include <signal.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
@@ -83,15 +87,40 @@
 /*#define SYS_ENM_CH0_A53_SCALE 13421772800.0*/
 /*#define SYS_ENM_CH0_GPU_SCALE 6710886400.0*/
 
+// Number of 32-bit registers from BASE_INDEX to the end of the APB counters
+#define NR_RAW_REGS (APB_SIZE / 4 - BASE_INDEX)
+
+// The 64-bit energy counters, as index and number of registers from BASE_INDEX
+#define ENERGY_INDEX 12
+#define NR_ENERGY_REGS 8
+
+// Maximum number of attempts to get a consistent read of a 64-bit counter
+#define MAX_READ_RETRIES 8
+
+// Number of raw readings buffered in binary mode before being written out
+#define RAW_BUFFER_READINGS 4096
+
+// Identification of binary output files, see struct raw_header
+#define RAW_MAGIC "RDENERGY"
+#define RAW_VERSION 2
+
 // Ignore individual errors but if see too many, abort.
 #define ERROR_THRESHOLD 10
 
 // Default counter poll period (in milliseconds).
 #define DEFAULT_PERIOD 100
 
+// Maximum length of a command received on the control FIFO, see -s
+#define CONTROL_BUFFER_SIZE 256
+
 // Default duration for the instrument execution (in seconds); 0 means 'forever'
 #define DEFAULT_DURATION 0
 
+#define NSEC_PER_SEC 1000000000ULL
+
+// Set by signal handlers to terminate the sampling loop
+volatile int done = 0;
+
 // A single reading from the energy meter. The values are the proper readings converted
 // to appropriate units (e.g. Watts for power); they are *not* raw counter values.
 struct reading
@@ -114,7 +143,30 @@ struct reading
 	double sys_enm_ch0_gpu;
 };
 
-static inline uint64_t join_64bit_register(uint32_t *buffer, int index)
+// The raw content of the registers, as found in binary output files. The scaling to
+// proper units is applied when converting them back to CSV (see -c).
+struct raw_reading
+{
+	// Time at which the registers were read, in nanoseconds of the sampling clock
+	uint64_t timestamp;
+	uint32_t regs[NR_RAW_REGS];
+};
+
+// Header of binary output files, followed by a sequence of struct raw_reading in
+// native endianness.
+struct raw_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t nr_regs;
+	// Sampling period in nanoseconds
+	uint64_t period;
+	// clockid_t of the sampling clock
+	uint32_t clock;
+	uint32_t reserved;
+};
+
+static inline uint64_t join_64bit_register(const uint32_t *buffer, int index)
 {
 	uint64_t result = 0;
 	result |= buffer[index];
@@ -122,40 +174,87 @@ static inline uint64_t join_64bit_register(uint32_t *buffer, int index)
 	return result;
 }
 
-int nsleep(const struct timespec *req, struct timespec *rem)
+// The 64-bit counters can only be read 32 bits at a time, so a carry from the low word
+// between the two loads would yield a torn value. Re-read the high word until it is
+// stable to get a consistent pair.
+static inline void read_64bit_register(volatile uint32_t *buffer, int index, uint32_t *result)
 {
-	struct timespec temp_rem;
-	if (nanosleep(req, rem) == -1)
-	{
-		if (errno == EINTR)
-		{
-			nsleep(rem, &temp_rem);
-		}
-		else
-		{
-			return errno;
-		}
-	}
-	else
-	{
-		return 0;
-	}
+	uint32_t low, high;
+	int retries = 0;
+
+	do {
+		high = buffer[index+1];
+		low = buffer[index];
+	} while (high != buffer[index+1] && ++retries < MAX_READ_RETRIES);
+
+	result[0] = low;
+	result[1] = high;
+}
+
+static inline uint64_t timespec_to_ns(const struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
 }
- 
+
+static inline void ns_to_timespec(uint64_t ns, struct timespec *ts)
+{
+	ts->tv_sec = (time_t)(ns / NSEC_PER_SEC);
+	ts->tv_nsec = (long)(ns % NSEC_PER_SEC);
+}
+
+// Sleep until the absolute time deadline of the given clock has been reached, or until a
+// signal asks us to terminate.
+int sleep_until(clockid_t clock, uint64_t deadline)
+{
+	struct timespec ts;
+	int ret;
+
+	ns_to_timespec(deadline, &ts);
+	do {
+		ret = clock_nanosleep(clock, TIMER_ABSTIME, &ts, NULL);
+	} while (ret == EINTR && !done);
+
+	return ret == EINTR ? 0 : ret;
+}
+
 void print_help()
 {
-	fprintf(stderr, "Usage: readenergy [-t PERIOD] [-o OUTFILE]\n\n"
+	fprintf(stderr, "Usage: readenergy [-t PERIOD] [-d DURATION] [-k CLOCK] [-p CPU] [-r PRIO]\n"
+			"                  [-b | -w WINDOW | -e] [-s CTLFIFO] [-o OUTFILE]\n"
+			"       readenergy -c BINFILE [-w WINDOW] [-o OUTFILE]\n\n"
 			"Read Juno energy counters every PERIOD milliseconds, writing them\n"
 			"to OUTFILE in CSV format either until SIGTERM is received OR\n"
 			"till the specified duration elapsed.\n"
 			"If OUTFILE is not specified, stdout will be used.\n\n"
 			"Parameters:\n"
-			"	PERIOD is the counter poll period in milliseconds.\n"
+			"	PERIOD is the counter poll period in milliseconds, fractional\n"
+			"	       values are accepted (e.g. 0.5).\n"
 			"	       (Defaults to 100 milliseconds.)\n"
 			"	DURATION is the duration before execution terminates.\n"
 			"		(Defaults to 0 seconds, meaning run till user\n"
 			"		terminates execution.\n"
-			"	OUTFILE is the output file path\n");
+			"	OUTFILE is the output file path\n"
+			"	CLOCK is the clock used to schedule and timestamp the\n"
+			"	       readings, either \"monotonic\" or \"boottime\".\n"
+			"	       (Defaults to monotonic.)\n"
+			"	CPU pins the process to the given CPU.\n"
+			"	PRIO runs the process with the SCHED_FIFO policy and the\n"
+			"	       given priority.\n"
+			"	-b writes the raw register values in binary format instead\n"
+			"	   of CSV, which is much cheaper for short periods.\n"
+			"	-c converts BINFILE, produced with -b, to CSV.\n"
+			"	-e only reads and writes the energy counters, which is enough\n"
+			"	   to get the energy over long periods.\n"
+			"	CTLFIFO runs as a daemon controlled by commands written to the\n"
+			"	       CTLFIFO FIFO: start, stop, mark [LABEL], reset and quit.\n"
+			"	       Readings are only taken between start and stop, and marks\n"
+			"	       are recorded in OUTFILE.marks. Requires OUTFILE.\n"
+			"	WINDOW only writes, for every WINDOW milliseconds, the min, max\n"
+			"	       and mean power and the energy consumed by each channel.\n"
+			"	       0 summarizes the whole run.\n\n"
+			"Readings happen on an absolute schedule of the sampling clock, so\n"
+			"the period does not drift with the time spent reading. Each one is\n"
+			"timestamped in seconds of that clock.\n");
 }
 
 // debugging only...
@@ -165,34 +264,282 @@ inline void dprint(char *msg)
 	sync();
 }
 
+void reading_from_raw(const struct raw_reading *raw, struct reading *reading)
+{
+	reading->sys_adc_ch0_pm1_sys = (double)(CMASK & raw->regs[0]) / SYS_ADC_CH0_PM1_SYS_SCALE;
+	reading->sys_adc_ch1_pm2_a57 = (double)(CMASK & raw->regs[1]) / SYS_ADC_CH1_PM2_A57_SCALE;
+	reading->sys_adc_ch2_pm3_a53 = (double)(CMASK & raw->regs[2]) / SYS_ADC_CH2_PM3_A53_SCALE;
+	reading->sys_adc_ch3_pm4_gpu = (double)(CMASK & raw->regs[3]) / SYS_ADC_CH3_PM4_GPU_SCALE;
+	reading->sys_adc_ch4_vsys = (double)(VMASK & raw->regs[4]) / SYS_ADC_CH4_VSYS_SCALE;
+	reading->sys_adc_ch5_va57 = (double)(VMASK & raw->regs[5]) / SYS_ADC_CH5_VA57_SCALE;
+	reading->sys_adc_ch6_va53 = (double)(VMASK & raw->regs[6]) / SYS_ADC_CH6_VA53_SCALE;
+	reading->sys_adc_ch7_vgpu = (double)(VMASK & raw->regs[7]) / SYS_ADC_CH7_VGPU_SCALE;
+	reading->sys_pow_ch04_sys = (double)(PMASK & raw->regs[8]) / SYS_POW_CH04_SYS_SCALE;
+	reading->sys_pow_ch15_a57 = (double)(PMASK & raw->regs[9]) / SYS_POW_CH15_A57_SCALE;
+	reading->sys_pow_ch26_a53 = (double)(PMASK & raw->regs[10]) / SYS_POW_CH26_A53_SCALE;
+	reading->sys_pow_ch37_gpu = (double)(PMASK & raw->regs[11]) / SYS_POW_CH37_GPU_SCALE;
+	reading->sys_enm_ch0_sys = (double)join_64bit_register(raw->regs, 12) / SYS_ENM_CH0_SYS_SCALE;
+	reading->sys_enm_ch1_a57 = (double)join_64bit_register(raw->regs, 14) / SYS_ENM_CH1_A57_SCALE;
+	reading->sys_enm_ch0_a53 = (double)join_64bit_register(raw->regs, 16) / SYS_ENM_CH0_A53_SCALE;
+	reading->sys_enm_ch0_gpu = (double)join_64bit_register(raw->regs, 18) / SYS_ENM_CH0_GPU_SCALE;
+}
+
+void write_energy_csv_header(FILE *out)
+{
+	fprintf(out, "sys_energy,a57_energy,a53_energy,gpu_energy,timestamp\n");
+}
+
+int write_energy_csv_reading(FILE *out, const struct reading *reading, uint64_t timestamp)
+{
+	return fprintf(out, "%f,%f,%f,%f,%llu.%09llu\n",
+			reading->sys_enm_ch0_sys,
+			reading->sys_enm_ch1_a57,
+			reading->sys_enm_ch0_a53,
+			reading->sys_enm_ch0_gpu,
+			(unsigned long long)(timestamp / NSEC_PER_SEC),
+			(unsigned long long)(timestamp % NSEC_PER_SEC));
+}
+
+void write_csv_header(FILE *out)
+{
+	fprintf(out, "sys_current,a57_current,a53_current,gpu_current,"
+		     "sys_voltage,a57_voltage,a53_voltage,gpu_voltage,"
+		     "sys_power,a57_power,a53_power,gpu_power,"
+		     "sys_energy,a57_energy,a53_energy,gpu_energy,timestamp\n");
+}
+
+int write_csv_reading(FILE *out, const struct reading *reading, uint64_t timestamp)
+{
+	return fprintf(out, "%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%llu.%09llu\n",
+			reading->sys_adc_ch0_pm1_sys,
+			reading->sys_adc_ch1_pm2_a57,
+			reading->sys_adc_ch2_pm3_a53,
+			reading->sys_adc_ch3_pm4_gpu,
+			reading->sys_adc_ch4_vsys,
+			reading->sys_adc_ch5_va57,
+			reading->sys_adc_ch6_va53,
+			reading->sys_adc_ch7_vgpu,
+			reading->sys_pow_ch04_sys,
+			reading->sys_pow_ch15_a57,
+			reading->sys_pow_ch26_a53,
+			reading->sys_pow_ch37_gpu,
+			reading->sys_enm_ch0_sys,
+			reading->sys_enm_ch1_a57,
+			reading->sys_enm_ch0_a53,
+			reading->sys_enm_ch0_gpu,
+			(unsigned long long)(timestamp / NSEC_PER_SEC),
+			(unsigned long long)(timestamp % NSEC_PER_SEC));
+}
+
+// -------------------------------------- window ----------------------------------------------------
+
+#define NR_CHANNELS 4
+
+static const char *const channel_names[NR_CHANNELS] = { "sys", "a57", "a53", "gpu" };
+
+// Summary of the readings over a window of time, see -w.
+struct window
+{
+	// Length of the window in nanoseconds; 0 means the whole run
+	uint64_t size;
+	// Timestamps of the first and last readings of the window
+	uint64_t start;
+	uint64_t end;
+	unsigned long nr_readings;
+	double power_min[NR_CHANNELS];
+	double power_max[NR_CHANNELS];
+	double power_sum[NR_CHANNELS];
+	// Energy counters at the end of the previous window and at the last reading,
+	// so that no energy is lost between consecutive windows.
+	double energy_start[NR_CHANNELS];
+	double energy_end[NR_CHANNELS];
+	int has_energy_start;
+};
+
+void window_init(struct window *this, uint64_t size)
+{
+	memset(this, 0, sizeof(*this));
+	this->size = size;
+}
+
+void write_window_header(FILE *out)
+{
+	int i;
+
+	fprintf(out, "start,end,samples");
+	for (i = 0; i < NR_CHANNELS; i++)
+		fprintf(out, ",%s_power_min,%s_power_max,%s_power_mean,%s_energy",
+			channel_names[i], channel_names[i], channel_names[i], channel_names[i]);
+	fprintf(out, "\n");
+}
+
+int window_flush(struct window *this, FILE *out)
+{
+	int i, ret;
+
+	if (!this->nr_readings)
+		return 0;
+
+	ret = fprintf(out, "%llu.%09llu,%llu.%09llu,%lu",
+		      (unsigned long long)(this->start / NSEC_PER_SEC),
+		      (unsigned long long)(this->start % NSEC_PER_SEC),
+		      (unsigned long long)(this->end / NSEC_PER_SEC),
+		      (unsigned long long)(this->end % NSEC_PER_SEC),
+		      this->nr_readings);
+	for (i = 0; i < NR_CHANNELS && ret >= 0; i++)
+		ret = fprintf(out, ",%f,%f,%f,%f",
+			      this->power_min[i], this->power_max[i],
+			      this->power_sum[i] / this->nr_readings,
+			      this->energy_end[i] - this->energy_start[i]);
+	if (ret >= 0)
+		ret = fprintf(out, "\n");
+
+	memcpy(this->energy_start, this->energy_end, sizeof(this->energy_start));
+	this->nr_readings = 0;
+	return ret;
+}
+
+// Account for a reading in the current window, first writing out the summary of the
+// window if the reading falls past its end. Returns a negative value if writing failed.
+int window_add(struct window *this, FILE *out, const struct reading *reading, uint64_t timestamp)
+{
+	double power[NR_CHANNELS] = {
+		reading->sys_pow_ch04_sys,
+		reading->sys_pow_ch15_a57,
+		reading->sys_pow_ch26_a53,
+		reading->sys_pow_ch37_gpu,
+	};
+	double energy[NR_CHANNELS] = {
+		reading->sys_enm_ch0_sys,
+		reading->sys_enm_ch1_a57,
+		reading->sys_enm_ch0_a53,
+		reading->sys_enm_ch0_gpu,
+	};
+	int i, ret = 0;
+
+	if (this->nr_readings && this->size && timestamp - this->start >= this->size)
+		ret = window_flush(this, out);
+
+	if (!this->has_energy_start)
+	{
+		memcpy(this->energy_start, energy, sizeof(energy));
+		this->has_energy_start = 1;
+	}
+
+	if (!this->nr_readings)
+	{
+		this->start = timestamp;
+		for (i = 0; i < NR_CHANNELS; i++)
+		{
+			this->power_min[i] = power[i];
+			this->power_max[i] = power[i];
+			this->power_sum[i] = 0;
+		}
+	}
+
+	for (i = 0; i < NR_CHANNELS; i++)
+	{
+		if (power[i] < this->power_min[i])
+			this->power_min[i] = power[i];
+		if (power[i] > this->power_max[i])
+			this->power_max[i] = power[i];
+		this->power_sum[i] += power[i];
+	}
+	memcpy(this->energy_end, energy, sizeof(energy));
+	this->end = timestamp;
+	this->nr_readings++;
+	return ret;
+}
+
+// -------------------------------------- /window ---------------------------------------------------
+
 // -------------------------------------- config ----------------------------------------------------
 
 struct config
 {
-	struct timespec period;
+	// Sampling period in nanoseconds
+	uint64_t period;
 	char *output_file;
+	char *convert_file;
+	char *control_file;
 	long duration_in_sec;
+	int binary;
+	int energy_only;
+	// Summary window in nanoseconds, or -1 to write all the readings
+	int64_t window;
+	clockid_t clock;
+	int cpu;
+	int fifo_prio;
 };
 
-void config_init_period_from_millis(struct config *this, long millis)
+void config_init_period_from_millis(struct config *this, double millis)
 {
-	this->period.tv_sec = (time_t)(millis / 1000);
-	this->period.tv_nsec = (millis % 1000) * 1000000;
+	if (millis <= 0)
+	{
+		fprintf(stderr, "ERROR: Invalid period %f\n", millis);
+		exit(EXIT_FAILURE);
+	}
+	this->period = (uint64_t)(millis * 1000000);
+}
+
+void config_init_clock(struct config *this, const char *name)
+{
+	if (!strcmp(name, "monotonic"))
+		this->clock = CLOCK_MONOTONIC;
+	else if (!strcmp(name, "boottime"))
+		this->clock = CLOCK_BOOTTIME;
+	else
+	{
+		fprintf(stderr, "ERROR: Unknown clock %s\n", name);
+		exit(EXIT_FAILURE);
+	}
 }
 
 void config_init(struct config *this, int argc, char *argv[])
 {
 	this->output_file = NULL;
+	this->convert_file = NULL;
+	this->control_file = NULL;
 	config_init_period_from_millis(this, DEFAULT_PERIOD);
 	this->duration_in_sec = DEFAULT_DURATION;
+	this->binary = 0;
+	this->energy_only = 0;
+	this->window = -1;
+	this->clock = CLOCK_MONOTONIC;
+	this->cpu = -1;
+	this->fifo_prio = 0;
 
 	int opt;
-	while ((opt = getopt(argc, argv, "ht:o:d:")) != -1)
+	while ((opt = getopt(argc, argv, "ht:o:d:bc:ek:p:r:s:w:")) != -1)
 	{
 		switch(opt)
 		{
+			case 'e':
+				this->energy_only = 1;
+				break;
+			case 's':
+				this->control_file = optarg;
+				break;
+			case 'w':
+				this->window = (int64_t)(atof(optarg) * 1000000);
+				break;
+			case 'k':
+				config_init_clock(this, optarg);
+				break;
+			case 'p':
+				this->cpu = atoi(optarg);
+				break;
+			case 'r':
+				this->fifo_prio = atoi(optarg);
+				break;
+			case 'b':
+				this->binary = 1;
+				break;
+			case 'c':
+				this->convert_file = optarg;
+				break;
 			case 't':
-				config_init_period_from_millis(this, atol(optarg));
+				config_init_period_from_millis(this, atof(optarg));
 				break;
 			case 'o':
 				this->output_file = optarg;
@@ -205,11 +552,64 @@ void config_init(struct config *this, int argc, char *argv[])
 				exit(EXIT_SUCCESS);
 				break;
 			default:
-				fprintf(stderr, "ERROR: Unexpected option %s\n\n", opt);
+				fprintf(stderr, "ERROR: Unexpected option %c\n\n", opt);
 				print_help();
 				exit(EXIT_FAILURE);
 		}
 	}
+
+	if (this->binary && this->window >= 0)
+	{
+		fprintf(stderr, "ERROR: -b and -w are mutually exclusive\n\n");
+		print_help();
+		exit(EXIT_FAILURE);
+	}
+
+	if (this->control_file && !this->output_file)
+	{
+		fprintf(stderr, "ERROR: -s requires an output file\n\n");
+		print_help();
+		exit(EXIT_FAILURE);
+	}
+
+	if (this->energy_only && (this->binary || this->window >= 0))
+	{
+		fprintf(stderr, "ERROR: -e cannot be used with -b or -w\n\n");
+		print_help();
+		exit(EXIT_FAILURE);
+	}
+}
+
+// Apply the CPU affinity and scheduling policy requested in the configuration.
+void config_apply_scheduling(struct config *this)
+{
+	if (this->cpu >= 0)
+	{
+		cpu_set_t cpus;
+
+		CPU_ZERO(&cpus);
+		CPU_SET(this->cpu, &cpus);
+		if (sched_setaffinity(0, sizeof(cpus), &cpus))
+		{
+			fprintf(stderr, "ERROR: Could not pin to CPU %d; got %s\n", this->cpu, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (this->fifo_prio)
+	{
+		struct sched_param param;
+
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = this->fifo_prio;
+		if (sched_setscheduler(0, SCHED_FIFO, &param))
+		{
+			fprintf(stderr, "ERROR: Could not set SCHED_FIFO priority %d; got %s\n", this->fifo_prio, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		// Avoid page faults in the sampling loop
+		mlockall(MCL_CURRENT | MCL_FUTURE);
+	}
 }
 
 // -------------------------------------- /config ---------------------------------------------------
@@ -221,10 +621,46 @@ struct emeter
 	int fd;
 	FILE *out;
 	void *mmap_base;
+	clockid_t clock;
+	uint64_t period;
+	int energy_only;
+	// Only used in window mode
+	struct window *window;
+	// Only used in binary mode
+	struct raw_reading *raw_buffer;
+	size_t raw_count;
 };
 
-void emeter_init(struct emeter *this, char *outfile)
+void emeter_write_header(struct emeter *this)
 {
+	if (this->raw_buffer)
+	{
+		struct raw_header header;
+
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, RAW_MAGIC, sizeof(header.magic));
+		header.version = RAW_VERSION;
+		header.nr_regs = NR_RAW_REGS;
+		header.period = this->period;
+		header.clock = this->clock;
+		if (fwrite(&header, sizeof(header), 1, this->out) != 1 || fflush(this->out))
+		{
+			fprintf(stderr, "ERROR: Could not write output file header; got %s\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	} else if (this->window) {
+		write_window_header(this->out);
+	} else if (this->energy_only) {
+		write_energy_csv_header(this->out);
+	} else {
+		write_csv_header(this->out);
+	}
+}
+
+void emeter_init(struct emeter *this, struct config *config)
+{
+	char *outfile = config->output_file;
+
 	if(outfile)
 	{
 		this->out = fopen(outfile, "w");
@@ -253,57 +689,96 @@ void emeter_init(struct emeter *this, char *outfile)
 		exit(EXIT_FAILURE);
 	}
 
-	if(this->out) {
-		fprintf(this->out, "sys_current,a57_current,a53_current,gpu_current,"
-				   "sys_voltage,a57_voltage,a53_voltage,gpu_voltage,"
-				   "sys_power,a57_power,a53_power,gpu_power,"
-				   "sys_energy,a57_energy,a53_energy,gpu_energy\n");
+	this->clock = config->clock;
+	this->period = config->period;
+	this->energy_only = config->energy_only;
+	this->window = NULL;
+	this->raw_buffer = NULL;
+	this->raw_count = 0;
+	if (config->binary)
+	{
+		this->raw_buffer = calloc(RAW_BUFFER_READINGS, sizeof(struct raw_reading));
+		if (this->raw_buffer == NULL)
+		{
+			fprintf(stderr, "ERROR: Could not allocate the reading buffer\n");
+			exit(EXIT_FAILURE);
+		}
+	} else if (config->window >= 0) {
+		this->window = malloc(sizeof(struct window));
+		if (this->window == NULL)
+		{
+			fprintf(stderr, "ERROR: Could not allocate the summary window\n");
+			exit(EXIT_FAILURE);
+		}
+		window_init(this->window, config->window);
 	}
+
+	emeter_write_header(this);
 }
 
-void emeter_read_measurements(struct emeter *this, struct reading *reading)
+void emeter_read_raw(struct emeter *this, struct raw_reading *raw)
 {
-	uint32_t *buffer = (uint32_t *)this->mmap_base;
-	reading->sys_adc_ch0_pm1_sys = (double)(CMASK & buffer[BASE_INDEX+0]) / SYS_ADC_CH0_PM1_SYS_SCALE;
-	reading->sys_adc_ch1_pm2_a57 = (double)(CMASK & buffer[BASE_INDEX+1]) / SYS_ADC_CH1_PM2_A57_SCALE;
-	reading->sys_adc_ch2_pm3_a53 = (double)(CMASK & buffer[BASE_INDEX+2]) / SYS_ADC_CH2_PM3_A53_SCALE;
-	reading->sys_adc_ch3_pm4_gpu = (double)(CMASK & buffer[BASE_INDEX+3]) / SYS_ADC_CH3_PM4_GPU_SCALE;
-	reading->sys_adc_ch4_vsys = (double)(VMASK & buffer[BASE_INDEX+4]) / SYS_ADC_CH4_VSYS_SCALE;
-	reading->sys_adc_ch5_va57 = (double)(VMASK & buffer[BASE_INDEX+5]) / SYS_ADC_CH5_VA57_SCALE;
-	reading->sys_adc_ch6_va53 = (double)(VMASK & buffer[BASE_INDEX+6]) / SYS_ADC_CH6_VA53_SCALE;
-	reading->sys_adc_ch7_vgpu = (double)(VMASK & buffer[BASE_INDEX+7]) / SYS_ADC_CH7_VGPU_SCALE;
-	reading->sys_pow_ch04_sys = (double)(PMASK & buffer[BASE_INDEX+8]) / SYS_POW_CH04_SYS_SCALE;
-	reading->sys_pow_ch15_a57 = (double)(PMASK & buffer[BASE_INDEX+9]) / SYS_POW_CH15_A57_SCALE;
-	reading->sys_pow_ch26_a53 = (double)(PMASK & buffer[BASE_INDEX+10]) / SYS_POW_CH26_A53_SCALE;
-	reading->sys_pow_ch37_gpu = (double)(PMASK & buffer[BASE_INDEX+11]) / SYS_POW_CH37_GPU_SCALE;
-	reading->sys_enm_ch0_sys = (double)join_64bit_register(buffer, BASE_INDEX+12) / SYS_ENM_CH0_SYS_SCALE;
-	reading->sys_enm_ch1_a57 = (double)join_64bit_register(buffer, BASE_INDEX+14) / SYS_ENM_CH1_A57_SCALE;
-	reading->sys_enm_ch0_a53 = (double)join_64bit_register(buffer, BASE_INDEX+16) / SYS_ENM_CH0_A53_SCALE;
-	reading->sys_enm_ch0_gpu = (double)join_64bit_register(buffer, BASE_INDEX+18) / SYS_ENM_CH0_GPU_SCALE;
+	// Device memory: make sure each register is read with a single 32-bit load
+	volatile uint32_t *buffer = (volatile uint32_t *)this->mmap_base;
+	struct timespec now;
+	int i;
+
+	clock_gettime(this->clock, &now);
+	raw->timestamp = timespec_to_ns(&now);
+	if (this->energy_only)
+		memset(raw->regs, 0, ENERGY_INDEX * sizeof(uint32_t));
+	else
+		for (i = 0; i < ENERGY_INDEX; i++)
+			raw->regs[i] = buffer[BASE_INDEX+i];
+
+	for (i = ENERGY_INDEX; i < ENERGY_INDEX + NR_ENERGY_REGS; i += 2)
+		read_64bit_register(buffer, BASE_INDEX+i, &raw->regs[i]);
+}
+
+void emeter_flush_raw(struct emeter *this)
+{
+	size_t size = this->raw_count * sizeof(struct raw_reading);
+	char *data = (char *)this->raw_buffer;
+
+	while (size)
+	{
+		ssize_t ret = write(fileno(this->out), data, size);
+		if (ret < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "ERROR: while writing meter readings: %s\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		data += ret;
+		size -= ret;
+	}
+	this->raw_count = 0;
 }
 
 void emeter_take_reading(struct emeter *this)
 {
 	static struct reading reading;
-	int error_count = 0;
-	emeter_read_measurements(this, &reading);
-	int ret = fprintf(this->out, "%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f\n",
-			reading.sys_adc_ch0_pm1_sys,
-			reading.sys_adc_ch1_pm2_a57,
-			reading.sys_adc_ch2_pm3_a53,
-			reading.sys_adc_ch3_pm4_gpu,
-			reading.sys_adc_ch4_vsys,
-			reading.sys_adc_ch5_va57,
-			reading.sys_adc_ch6_va53,
-			reading.sys_adc_ch7_vgpu,
-			reading.sys_pow_ch04_sys,
-			reading.sys_pow_ch15_a57,
-			reading.sys_pow_ch26_a53,
-			reading.sys_pow_ch37_gpu,
-			reading.sys_enm_ch0_sys,
-			reading.sys_enm_ch1_a57,
-			reading.sys_enm_ch0_a53,
-			reading.sys_enm_ch0_gpu);
+	static int error_count = 0;
+	struct raw_reading raw;
+
+	if (this->raw_buffer)
+	{
+		emeter_read_raw(this, &this->raw_buffer[this->raw_count++]);
+		if (this->raw_count == RAW_BUFFER_READINGS)
+			emeter_flush_raw(this);
+		return;
+	}
+
+	emeter_read_raw(this, &raw);
+	reading_from_raw(&raw, &reading);
+	int ret;
+	if (this->window)
+		ret = window_add(this->window, this->out, &reading, raw.timestamp);
+	else if (this->energy_only)
+		ret = write_energy_csv_reading(this->out, &reading, raw.timestamp);
+	else
+		ret = write_csv_reading(this->out, &reading, raw.timestamp);
 	if (ret < 0)
 	{
 		fprintf(stderr, "ERROR: while writing a meter reading: %s\n", strerror(errno));
@@ -312,8 +787,48 @@ void emeter_take_reading(struct emeter *this)
 	}
 }
 
+// Write out everything recorded so far, e.g. when sampling is paused. In window mode,
+// the next window will start afresh.
+void emeter_flush(struct emeter *this)
+{
+	if (this->raw_buffer)
+		emeter_flush_raw(this);
+
+	if (this->window)
+	{
+		window_flush(this->window, this->out);
+		window_init(this->window, this->window->size);
+	}
+	fflush(this->out);
+}
+
+// Discard everything recorded so far.
+void emeter_reset(struct emeter *this)
+{
+	this->raw_count = 0;
+	if (this->window)
+		window_init(this->window, this->window->size);
+
+	fflush(this->out);
+	if (ftruncate(fileno(this->out), 0) || fseek(this->out, 0, SEEK_SET))
+		fprintf(stderr, "ERROR: Could not truncate the output file; got %s\n", strerror(errno));
+	emeter_write_header(this);
+}
+
 void emeter_finalize(struct emeter *this)
 {
+	if (this->raw_buffer)
+	{
+		emeter_flush_raw(this);
+		free(this->raw_buffer);
+	}
+
+	if (this->window)
+	{
+		window_flush(this->window, this->out);
+		free(this->window);
+	}
+
 	if (munmap(this->mmap_base, APB_SIZE) == -1) 
 	{
 		// Report the error but don't bother doing anything else, as we're not gonna do 
@@ -326,7 +841,204 @@ void emeter_finalize(struct emeter *this)
 
 // -------------------------------------- /emeter ----------------------------------------------------
 
-volatile int done = 0;
+// -------------------------------------- control ---------------------------------------------------
+
+// Control FIFO of the daemon mode, see -s. It accepts one command per line:
+//   start          start taking readings
+//   stop           stop taking readings, writing out what was recorded
+//   mark [LABEL]   record the current time in the marks file; in window mode, the
+//                  current window is ended
+//   reset          discard everything recorded so far
+//   quit           terminate
+struct control
+{
+	char *path;
+	int fd;
+	// Keeps the FIFO open for writing, so that reads do not hit EOF each time a
+	// client closes its end.
+	int dummy_fd;
+	FILE *marks;
+	char buffer[CONTROL_BUFFER_SIZE];
+	size_t len;
+	int running;
+};
+
+void write_marks_header(FILE *out)
+{
+	fprintf(out, "timestamp,label\n");
+}
+
+void control_init(struct control *this, char *path, char *outfile)
+{
+	char marks_file[PATH_MAX];
+
+	if (mkfifo(path, 0600) && errno != EEXIST)
+	{
+		fprintf(stderr, "ERROR: Could not create control FIFO %s; got %s\n", path, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	this->fd = open(path, O_RDONLY | O_NONBLOCK);
+	this->dummy_fd = this->fd < 0 ? -1 : open(path, O_WRONLY);
+	if (this->dummy_fd < 0)
+	{
+		fprintf(stderr, "ERROR: Could not open control FIFO %s; got %s\n", path, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	snprintf(marks_file, sizeof(marks_file), "%s.marks", outfile);
+	this->marks = fopen(marks_file, "w");
+	if (this->marks == NULL)
+	{
+		fprintf(stderr, "ERROR: Could not open marks file %s; got %s\n", marks_file, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	write_marks_header(this->marks);
+	fflush(this->marks);
+
+	this->path = path;
+	this->len = 0;
+	this->running = 0;
+}
+
+void control_command(struct control *this, struct emeter *emeter, char *command)
+{
+	if (!strcmp(command, "start"))
+	{
+		this->running = 1;
+	} else if (!strcmp(command, "stop")) {
+		if (this->running)
+			emeter_flush(emeter);
+		this->running = 0;
+	} else if (!strncmp(command, "mark", 4) && (command[4] == '\0' || command[4] == ' ')) {
+		struct timespec now;
+		uint64_t timestamp;
+
+		clock_gettime(emeter->clock, &now);
+		timestamp = timespec_to_ns(&now);
+		if (emeter->window)
+			window_flush(emeter->window, emeter->out);
+		fprintf(this->marks, "%llu.%09llu,%s\n",
+			(unsigned long long)(timestamp / NSEC_PER_SEC),
+			(unsigned long long)(timestamp % NSEC_PER_SEC),
+			command[4] ? command + 5 : "");
+		fflush(this->marks);
+	} else if (!strcmp(command, "reset")) {
+		emeter_reset(emeter);
+		fflush(this->marks);
+		if (ftruncate(fileno(this->marks), 0) || fseek(this->marks, 0, SEEK_SET))
+			fprintf(stderr, "ERROR: Could not truncate the marks file; got %s\n", strerror(errno));
+		write_marks_header(this->marks);
+		fflush(this->marks);
+	} else if (!strcmp(command, "quit")) {
+		done = 1;
+	} else if (command[0]) {
+		fprintf(stderr, "WARNING: Unknown command \"%s\"\n", command);
+	}
+}
+
+// Process the pending commands, waiting for one to arrive if block is set.
+void control_process(struct control *this, struct emeter *emeter, int block)
+{
+	char *line, *end;
+	ssize_t ret;
+
+	if (block)
+	{
+		struct pollfd pfd = { .fd = this->fd, .events = POLLIN };
+
+		if (poll(&pfd, 1, -1) <= 0)
+			return;
+	}
+
+	ret = read(this->fd, this->buffer + this->len, sizeof(this->buffer) - 1 - this->len);
+	if (ret <= 0)
+		return;
+	this->len += ret;
+	this->buffer[this->len] = '\0';
+
+	line = this->buffer;
+	while ((end = strchr(line, '\n')))
+	{
+		*end = '\0';
+		if (end > line && end[-1] == '\r')
+			end[-1] = '\0';
+		control_command(this, emeter, line);
+		line = end + 1;
+	}
+
+	this->len -= line - this->buffer;
+	if (this->len == sizeof(this->buffer) - 1)
+	{
+		fprintf(stderr, "WARNING: Dropping overlong command\n");
+		this->len = 0;
+	}
+	memmove(this->buffer, line, this->len);
+}
+
+void control_finalize(struct control *this)
+{
+	close(this->fd);
+	close(this->dummy_fd);
+	fclose(this->marks);
+	unlink(this->path);
+}
+
+// -------------------------------------- /control --------------------------------------------------
+
+// -------------------------------------- convert ---------------------------------------------------
+
+// Convert a binary file produced with -b to the CSV format, summarizing it if window is
+// not negative.
+int convert_raw_file(const char *infile, FILE *out, int64_t window)
+{
+	struct window summary;
+	struct raw_header header;
+	struct raw_reading raw;
+	struct reading reading;
+	FILE *in;
+
+	in = fopen(infile, "rb");
+	if (in == NULL)
+	{
+		fprintf(stderr, "ERROR: Could not open input file %s; got %s\n", infile, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	if (fread(&header, sizeof(header), 1, in) != 1 ||
+	    memcmp(header.magic, RAW_MAGIC, sizeof(header.magic)) ||
+	    header.version != RAW_VERSION || header.nr_regs != NR_RAW_REGS)
+	{
+		fprintf(stderr, "ERROR: %s is not a readenergy binary file\n", infile);
+		fclose(in);
+		return EXIT_FAILURE;
+	}
+
+	if (window >= 0)
+	{
+		window_init(&summary, window);
+		write_window_header(out);
+	} else {
+		write_csv_header(out);
+	}
+
+	while (fread(&raw, sizeof(raw), 1, in) == 1)
+	{
+		reading_from_raw(&raw, &reading);
+		if (window >= 0)
+			window_add(&summary, out, &reading, raw.timestamp);
+		else
+			write_csv_reading(out, &reading, raw.timestamp);
+	}
+
+	if (window >= 0)
+		window_flush(&summary, out);
+
+	fclose(in);
+	return EXIT_SUCCESS;
+}
+
+// -------------------------------------- /convert --------------------------------------------------
 
 void term_handler(int signum)
 {
@@ -349,7 +1061,28 @@ int main(int argc, char *argv[])
 	struct config config;
 	struct emeter emeter;
 	config_init(&config, argc, argv);
-	emeter_init(&emeter, config.output_file);
+
+	if (config.convert_file)
+	{
+		FILE *out = stdout;
+		int ret;
+
+		if (config.output_file)
+		{
+			out = fopen(config.output_file, "w");
+			if (out == NULL)
+			{
+				fprintf(stderr, "ERROR: Could not open output file %s; got %s\n", config.output_file, strerror(errno));
+				return EXIT_FAILURE;
+			}
+		}
+		ret = convert_raw_file(config.convert_file, out, config.window);
+		fclose(out);
+		return ret;
+	}
+
+	emeter_init(&emeter, &config);
+	config_apply_scheduling(&config);
 
 	if (0 != config.duration_in_sec)
 	{
@@ -364,12 +1097,51 @@ int main(int argc, char *argv[])
 
 	if(config.output_file)
 	{
-		struct timespec remaining;
+		struct control control;
+		struct timespec now;
+		uint64_t deadline, late, missed = 0;
+
+		if (config.control_file)
+			control_init(&control, config.control_file, config.output_file);
+
+		clock_gettime(config.clock, &now);
+		deadline = timespec_to_ns(&now);
 		while (!done)
 		{
+			if (config.control_file)
+			{
+				int was_running = control.running;
+
+				// Only wait for commands when there is no reading to take
+				control_process(&control, &emeter, !was_running);
+				if (!control.running || done)
+					continue;
+				if (!was_running)
+				{
+					clock_gettime(config.clock, &now);
+					deadline = timespec_to_ns(&now);
+				}
+			}
+
 			emeter_take_reading(&emeter);
-			nsleep(&config.period, &remaining);
+			deadline += config.period;
+
+			// If we overran, skip the deadlines we missed rather than taking a
+			// burst of readings to catch up.
+			clock_gettime(config.clock, &now);
+			if (timespec_to_ns(&now) >= deadline)
+			{
+				late = (timespec_to_ns(&now) - deadline) / config.period + 1;
+				deadline += late * config.period;
+				missed += late;
+			}
+			sleep_until(config.clock, deadline);
 		}
+
+		if (missed)
+			fprintf(stderr, "WARNING: missed %llu sampling deadlines\n", (unsigned long long)missed);
+		if (config.control_file)
+			control_finalize(&control);
 	} else 	{
 		emeter_take_reading(&emeter);
 	}
@@ -13,7 +13,9 @@
 # limitations under the License.
 # pylint: disable=access-member-before-definition,attribute-defined-outside-init,unused-argument
 import os
+import struct
 
+import numpy as np
 import pandas as pd
 
 from wa import Instrument, Parameter, Executable
@@ -41,11 +43,19 @@ class FilePoller(Instrument):
                   description="""The interval between samples in mS."""),
         Parameter('files', kind=list_or_string, mandatory=True,
                   description="""A list of paths to the files to be polled"""),
+        Parameter('notify_files', kind=list_or_string, default=[],
+                  description="""
+                  A list of paths to files supporting ``sysfs_notify()``, such as
+                  some thermal and devfreq attributes. Rather than being read
+                  every sample interval, these files are polled for changes and
+                  a sample is recorded each time one of them changes. Their
+                  columns come after the ones of ``files``.
+                  """),
         Parameter('labels', kind=list_or_string,
                   description="""
                   A list of lables to be used in the CSV output for the
-                  corresponding files. This cannot be used if a `*` wildcard is
-                  used in a path.
+                  corresponding files, followed by the notify files. This cannot
+                  be used if a `*` wildcard is used in a path.
                   """),
         Parameter('align_with_ftrace', kind=bool, default=False,
                   description="""
@@ -54,6 +64,20 @@ class FilePoller(Instrument):
                   and use it's timestamp to adjust the timestamps in the collected
                   csv so that they align with ftrace.
                   """),
+        Parameter('binary_output', kind=bool, default=False,
+                  description="""
+                  Have the poller write its samples in a compact binary format,
+                  which is cheaper to produce on the target, and convert them to
+                  CSV on the host. This is only suitable for files containing a
+                  single integer value.
+                  """),
+        Parameter('changes_only', kind=bool, default=False,
+                  description="""
+                  Only record a sample when at least one of the values changed,
+                  so that the output size scales with activity rather than
+                  duration. Each value then holds until the next sample, and the
+                  last sample is always recorded.
+                  """),
         Parameter('as_root', kind=bool, default=False,
                   description="""
                   Whether or not the poller will be run as root. This should be
@@ -64,7 +88,7 @@ class FilePoller(Instrument):
     def validate(self):
         if not self.files:
             raise ConfigError('You must specify atleast one file to poll')
-        if self.labels and any(['*' in f for f in self.files]):
+        if self.labels and any(['*' in f for f in self.files + self.notify_files]):
             raise ConfigError('You cannot used manual labels with `*` wildcards')
 
     def initialize(self, context):
@@ -74,23 +98,25 @@ class FilePoller(Instrument):
                                                       "poller"))
         target_poller = self.target.install(host_poller)
 
-        expanded_paths = []
-        for path in self.files:
-            if "*" in path:
-                for p in self.target.list_directory(path):
-                    expanded_paths.append(p)
-            else:
-                expanded_paths.append(path)
-        self.files = expanded_paths
+        self.files = self._expand_paths(self.files)
+        self.notify_files = self._expand_paths(self.notify_files)
         if not self.labels:
             self.labels = self._generate_labels()
 
-        self.target_output_path = self.target.path.join(self.target.working_directory, 'poller.csv')
+        output_name = 'poller.bin' if self.binary_output else 'poller.csv'
+        self.target_output_path = self.target.path.join(self.target.working_directory, output_name)
         self.target_log_path = self.target.path.join(self.target.working_directory, 'poller.log')
         marker_option = ''
         if self.align_with_ftrace:
             marker_option = '-m'
             signal.connect(self._adjust_timestamps, signal.AFTER_JOB_OUTPUT_PROCESSED)
+        if self.binary_output:
+            marker_option += ' -b'
+        if self.changes_only:
+            marker_option += ' -d'
+        for path in self.notify_files:
+            marker_option += ' -n {}'.format(path)
+        self._check_poller_options(target_poller)
         self.command = '{} -t {} {} -l {} {} > {} 2>{}'.format(target_poller,
                                                                self.sample_interval * 1000,
                                                                marker_option,
@@ -107,7 +133,13 @@ class FilePoller(Instrument):
 
     def update_output(self, context):
         host_output_file = os.path.join(context.output_directory, 'poller.csv')
-        self.target.pull(self.target_output_path, host_output_file)
+        if self.binary_output:
+            host_binary_file = os.path.join(context.output_directory, 'poller.bin')
+            self.target.pull(self.target_output_path, host_binary_file)
+            self._read_binary(host_binary_file).to_csv(host_output_file, index=False)
+            os.remove(host_binary_file)
+        else:
+            self.target.pull(self.target_output_path, host_output_file)
         context.add_artifact('poller-output', host_output_file, kind='data')
 
         host_log_file = os.path.join(context.output_directory, 'poller.log')
@@ -116,7 +148,7 @@ class FilePoller(Instrument):
 
         with open(host_log_file) as fh:
             for line in fh:
-                if 'ERROR' in line:
+                if 'ERROR' in line or line.startswith('usage:'):
                     raise InstrumentError(line.strip())
                 if 'WARNING' in line:
                     self.logger.warning(line.strip())
@@ -125,9 +157,40 @@ class FilePoller(Instrument):
         self.target.remove(self.target_output_path)
         self.target.remove(self.target_log_path)
 
+    def _check_poller_options(self, target_poller):
+        # The poller is started in the background with its stderr redirected,
+        # so make sure up front that it supports the options that are used.
+        # Older builds only accept -h, -m, -t and -l.
+        required = [('binary_output', self.binary_output, '-b'),
+                    ('changes_only', self.changes_only, '-d'),
+                    ('notify_files', self.notify_files, '-n')]
+        required = [(name, option) for name, enabled, option in required if enabled]
+        if not required:
+            return
+        usage = self.target.execute('{} -h 2>&1'.format(target_poller),
+                                    check_exit_code=False)
+        unsupported = [name for name, option in required
+                       if '    {} '.format(option) not in usage]
+        if unsupported:
+            msg = 'The poller binary on the target does not support {}; ' \
+                  'rebuild it with the Makefile in {}'
+            raise InstrumentError(msg.format(', '.join(unsupported),
+                                             os.path.dirname(__file__)))
+
+    def _expand_paths(self, paths):
+        expanded_paths = []
+        for path in paths:
+            if "*" in path:
+                for p in self.target.list_directory(path):
+                    expanded_paths.append(p)
+            else:
+                expanded_paths.append(path)
+        return expanded_paths
+
     def _generate_labels(self):
         # Split paths into their parts
-        path_parts = [f.split(self.target.path.sep) for f in self.files]
+        path_parts = [f.split(self.target.path.sep)
+                      for f in self.files + self.notify_files]
         # Identify which parts differ between at least two of the paths
         differ_map = [len(set(x)) > 1 for x in zip(*path_parts)]
 
@@ -140,6 +203,34 @@ class FilePoller(Instrument):
             labels.append('-'.join(label_parts))
         return labels
 
+    @staticmethod
+    def _read_binary(path):
+        with open(path, 'rb') as fh:
+            data = fh.read()
+
+        header = struct.Struct('=8sII')
+        magic, version, num_files = header.unpack_from(data)
+        if magic != b'POLLER\0\0' or version != 1:
+            raise InstrumentError('"{}" is not a poller binary output'.format(path))
+
+        offset = header.size
+        labels = []
+        for _ in range(num_files):
+            end = data.index(b'\0', offset)
+            labels.append(data[offset:end].decode())
+            offset = end + 1
+
+        # Drop any partially written sample at the end
+        record_size = 8 * (num_files + 1)
+        size = (len(data) - offset) // record_size * record_size
+        samples = np.frombuffer(data, dtype=np.int64, count=size // 8, offset=offset)
+        samples = samples.reshape(-1, num_files + 1)
+
+        df = pd.DataFrame(samples[:, 1:], columns=labels)
+        df = df.where(df != np.iinfo(np.int64).min)
+        df.insert(0, 'time', samples[:, 0] / 1e9)
+        return df
+
     def _adjust_timestamps(self, context):
         output_file = context.get_artifact_path('poller-output')
         message = 'Adjusting timestamps inside "{}" to align with ftrace'
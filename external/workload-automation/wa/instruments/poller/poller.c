@@ -13,7 +13,11 @@
  * limitations under the License.
 */
 
+#define _GNU_SOURCE
 #include <fcntl.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <sys/poll.h>
 #include <time.h>
@@ -23,6 +27,24 @@
 #include <string.h>
 #include <stdlib.h>
 
+#define READ_BUFFER_SIZE 1024
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+#define BINARY_MAGIC "POLLER\0\0"
+#define BINARY_VERSION 1
+/* Value recorded in binary output for files that could not be read or parsed */
+#define BINARY_NO_VALUE INT64_MIN
+
+/* Latencies are recorded with a 1us resolution, anything longer lands in the last bucket */
+#define LATENCY_HIST_SIZE 10000
+
+/* Flags of output_sample() */
+#define OUTPUT_BINARY (1 << 0)
+#define OUTPUT_CHANGES (1 << 1)
+
+#define NSEC_PER_SEC 1000000000LL
+#define NSEC_PER_USEC 1000LL
+
 volatile sig_atomic_t done = 0;
 void term(int signum)
 {
@@ -44,23 +66,331 @@ void strip(char *s) {
 typedef struct {
         int fd;
         char *path;
+        char *label;
+        /* Read when sysfs_notify() signals a change rather than periodically */
+        int notify;
+        /* Last value read, stripped for CSV output and parsed for binary output */
+        char value[READ_BUFFER_SIZE];
+        size_t len;
+        int64_t int_value;
+        /* Whether the value changed since the last sample was output */
+        int changed;
 } poll_source_t;
 
+/*
+ * Output is accumulated here and written to STDOUT in large blocks, rather
+ * than going through stdio for every value.
+ */
+typedef struct {
+        char data[OUTPUT_BUFFER_SIZE];
+        size_t len;
+} output_buffer_t;
+
+static output_buffer_t output;
 
-int write_trace_marker(char *marker, int size)
+void write_all(int fd, const char *data, size_t len)
 {
-        int ret;
-        FILE *file;
+        ssize_t ret;
+
+        while (len) {
+                ret = write(fd, data, len);
+                if (ret < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        fprintf(stderr, "ERROR writing output: %s\n", strerror(errno));
+                        exit(2);
+                }
+                data += ret;
+                len -= ret;
+        }
+}
+
+void output_flush(void)
+{
+        write_all(STDOUT_FILENO, output.data, output.len);
+        output.len = 0;
+}
+
+void output_append(const void *data, size_t len)
+{
+        if (output.len + len > sizeof(output.data))
+                output_flush();
+
+        if (len > sizeof(output.data)) {
+                write_all(STDOUT_FILENO, data, len);
+                return;
+        }
+
+        memcpy(output.data + output.len, data, len);
+        output.len += len;
+}
+
+void output_printf(const char *fmt, ...)
+{
+        char buf[READ_BUFFER_SIZE];
+        va_list args;
+        int len;
+
+        va_start(args, fmt);
+        len = vsnprintf(buf, sizeof(buf), fmt, args);
+        va_end(args);
+
+        if (len > 0)
+                output_append(buf, len < (int)sizeof(buf) ? len : (int)sizeof(buf) - 1);
+}
+
+/*
+ * Histogram of latencies, from which percentiles are reported on exit when
+ * sampling on absolute deadlines.
+ */
+typedef struct {
+        const char *name;
+        unsigned int buckets[LATENCY_HIST_SIZE];
+        unsigned long count;
+        int64_t max;
+} latency_hist_t;
+
+static latency_hist_t wakeup_latency = { .name = "wakeup latency" };
+static latency_hist_t sample_duration = { .name = "sample duration" };
+
+void latency_hist_add(latency_hist_t *hist, int64_t ns)
+{
+        int64_t us = ns / NSEC_PER_USEC;
+
+        if (us < 0)
+                us = 0;
+        if (us >= LATENCY_HIST_SIZE)
+                us = LATENCY_HIST_SIZE - 1;
+        hist->buckets[us]++;
+        hist->count++;
+        if (ns > hist->max)
+                hist->max = ns;
+}
+
+/* Returns the given percentile of the recorded latencies, in microseconds */
+int latency_hist_percentile(latency_hist_t *hist, double percentile)
+{
+        unsigned long target = (unsigned long)(hist->count * percentile / 100);
+        unsigned long seen = 0;
+        int i;
+
+        for (i = 0; i < LATENCY_HIST_SIZE; i++) {
+                seen += hist->buckets[i];
+                if (seen > target)
+                        return i;
+        }
+        return LATENCY_HIST_SIZE - 1;
+}
+
+void latency_hist_report(latency_hist_t *hist)
+{
+        if (!hist->count)
+                return;
+
+        fprintf(stderr, "%s (us): p50=%d p90=%d p99=%d max=%lld\n", hist->name,
+                latency_hist_percentile(hist, 50),
+                latency_hist_percentile(hist, 90),
+                latency_hist_percentile(hist, 99),
+                (long long)(hist->max / NSEC_PER_USEC));
+}
+
+static inline int64_t timespec_to_ns(const struct timespec *ts)
+{
+        return (int64_t)ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
+/* Sleep until the given CLOCK_BOOTTIME deadline, unless asked to terminate */
+void sleep_until(int64_t deadline)
+{
+        struct timespec ts;
+
+        ts.tv_sec = deadline / NSEC_PER_SEC;
+        ts.tv_nsec = deadline % NSEC_PER_SEC;
+        while (clock_nanosleep(CLOCK_BOOTTIME, TIMER_ABSTIME, &ts, NULL) == EINTR && !done)
+                ;
+}
+
+int pin_to_cpu(int cpu)
+{
+        cpu_set_t cpus;
+
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        return sched_setaffinity(0, sizeof(cpus), &cpus) ? -errno : 0;
+}
+
+/*
+ * Binary output starts with this header, followed by the labels of the
+ * files as NUL-terminated strings. Each sample is then recorded as an int64
+ * timestamp in nanoseconds, followed by one int64 per file, all in native
+ * endianness.
+ */
+typedef struct {
+        char magic[8];
+        uint32_t version;
+        uint32_t num_files;
+} binary_header_t;
+
+int64_t parse_value(const char *buf)
+{
+        char *end;
+        long long value;
+
+        errno = 0;
+        value = strtoll(buf, &end, 0);
+        if (errno || end == buf)
+                return BINARY_NO_VALUE;
+        while (*end == ' ' || *end == '\n')
+                end++;
+        if (*end != '\0')
+                return BINARY_NO_VALUE;
+        return value;
+}
+
+
+void read_source(poll_source_t *source)
+{
+        char buf[READ_BUFFER_SIZE];
+        ssize_t bytes_read;
+        size_t len;
+
+        bytes_read = pread(source->fd, buf, sizeof(buf) - 1, 0);
+        if (bytes_read < 0) {
+                fprintf(stderr, "WARNING: Read nothing from \"%s\"\n", source->path);
+                bytes_read = 0;
+        }
+        buf[bytes_read] = '\0';
+
+        source->int_value = parse_value(buf);
+        strip(buf);
+        len = strlen(buf);
+        if (len != source->len || memcmp(buf, source->value, len)) {
+                memcpy(source->value, buf, len + 1);
+                source->len = len;
+                source->changed = 1;
+        }
+}
+
+/* Timestamp of the last sample skipped by OUTPUT_CHANGES, if any */
+static struct timespec skipped_timestamp;
+static int skipped_sample;
+
+/*
+ * Output the current values of the sources. With OUTPUT_CHANGES, the sample
+ * is skipped if none of them changed since the last one output.
+ */
+void output_sample(poll_source_t *sources, int num_sources,
+                   const struct timespec *timestamp, int flags)
+{
+        int i, changed = 0;
+
+        for (i = 0; i < num_sources; i++) {
+                changed |= sources[i].changed;
+                sources[i].changed = 0;
+        }
+
+        if ((flags & OUTPUT_CHANGES) && !changed) {
+                skipped_timestamp = *timestamp;
+                skipped_sample = 1;
+                return;
+        }
+        skipped_sample = 0;
+
+        if (flags & OUTPUT_BINARY) {
+                int64_t ns = (int64_t)timestamp->tv_sec * NSEC_PER_SEC + timestamp->tv_nsec;
+
+                output_append(&ns, sizeof(ns));
+                for (i = 0; i < num_sources; i++)
+                        output_append(&sources[i].int_value, sizeof(sources[i].int_value));
+        } else {
+                double time_float = (double)timestamp->tv_sec;
+
+                time_float += ((double)timestamp->tv_nsec)/1000/1000/1000;
+                output_printf("%f", time_float);
+                for (i = 0; i < num_sources; i++) {
+                        output_append(",", 1);
+                        output_append(sources[i].value, sources[i].len);
+                }
+                output_append("\n", 1);
+        }
+}
+
+/*
+ * With OUTPUT_CHANGES, output the last sample again if it was skipped, so
+ * that the output covers the whole duration of the polling.
+ */
+void output_final_sample(poll_source_t *sources, int num_sources, int flags)
+{
+        if (skipped_sample)
+                output_sample(sources, num_sources, &skipped_timestamp,
+                              flags & ~OUTPUT_CHANGES);
+}
+
+/*
+ * Wait until the given CLOCK_BOOTTIME deadline, or forever if it is
+ * negative, recording a sample each time one of the notify sources changes.
+ */
+void wait_for_events(poll_source_t *sources, int num_sources,
+                     struct pollfd *pfds, poll_source_t **pfd_sources, int num_pfds,
+                     int64_t deadline, int flags)
+{
+        struct timespec now, timeout;
+        int64_t remaining;
+        int i, ret;
+
+        while (!done) {
+                if (deadline >= 0) {
+                        clock_gettime(CLOCK_BOOTTIME, &now);
+                        remaining = deadline - timespec_to_ns(&now);
+                        if (remaining <= 0)
+                                return;
+                        timeout.tv_sec = remaining / NSEC_PER_SEC;
+                        timeout.tv_nsec = remaining % NSEC_PER_SEC;
+                }
+
+                ret = ppoll(pfds, num_pfds, deadline >= 0 ? &timeout : NULL, NULL);
+                if (ret < 0 && errno != EINTR) {
+                        fprintf(stderr, "ERROR: ppoll() failed: %s\n", strerror(errno));
+                        done = 1;
+                }
+                if (ret <= 0)
+                        continue;
+
+                clock_gettime(CLOCK_BOOTTIME, &now);
+                for (i = 0; i < num_pfds; i++) {
+                        if (pfds[i].revents)
+                                read_source(pfd_sources[i]);
+                }
+                output_sample(sources, num_sources, &now, flags);
+        }
+}
+
+static const char *trace_marker_paths[] = {
+        "/sys/kernel/debug/tracing/trace_marker",
+        "/sys/kernel/tracing/trace_marker",
+};
+
+/* Kept open, as markers may be written for every sample */
+static int trace_marker_fd = -1;
+
+int open_trace_marker(void)
+{
+        unsigned int i;
 
-        file = fopen("/sys/kernel/debug/tracing/trace_marker", "w");
-        if (file == NULL) {
-                return -errno;
+        for (i = 0; i < sizeof(trace_marker_paths) / sizeof(trace_marker_paths[0]); i++) {
+                trace_marker_fd = open(trace_marker_paths[i], O_WRONLY);
+                if (trace_marker_fd >= 0)
+                        return 0;
         }
+        return -errno;
+}
 
-        ret = fwrite(marker, sizeof(char), size, file);
+int write_trace_marker(const char *marker, int size)
+{
+        int ret;
 
-        fclose(file);
-        return ret;
+        ret = write(trace_marker_fd, marker, size);
+        return ret < 0 ? -errno : ret;
 }
 
 int main(int argc, char ** argv) {
@@ -70,16 +400,27 @@ int main(int argc, char ** argv) {
     int c = 0;
     int show_help = 0;
     useconds_t interval = 1000000;
-    char buf[1024];
-    memset(buf, 0, sizeof(buf));
     struct timespec current_time;
-    double time_float;
     char *labels;
+    char *notify_paths[argc];
+    int num_notify = 0;
     int labelCount = 0;
     int should_write_marker = 0;
+    unsigned int sync_interval = 0;
+    unsigned long sample_count = 0;
+    unsigned long sync_seq = 0;
+    char marker[128];
+    int binary = 0;
+    int changes_only = 0;
+    int output_flags;
+    int absolute = 0;
+    int cpu = -1;
+    int64_t deadline = 0, missed = 0;
+    struct timespec end_time;
     int ret;
 
-    static char usage[] = "usage: %s [-h] [-m] [-t INTERVAL] FILE [FILE ...]\n"
+    static char usage[] = "usage: %s [-h] [-m] [-b] [-a] [-c CPU] [-t INTERVAL] [-l LABELS]\n"
+                          "          [-s SAMPLES] [-d] [-n NFILE ...] FILE [FILE ...]\n"
                           "polls FILE(s) every INTERVAL microseconds and outputs\n"
                           "the results in CSV format including a timestamp to STDOUT\n"
                           "\n"
@@ -87,14 +428,34 @@ int main(int argc, char ** argv) {
                           "    -m     Insert a marker into ftrace at the time of the first\n"
                           "           sample. This marker may be used to align the timestamps\n"
                           "           produced by the poller with those of ftrace events.\n"
+                          "    -s     Insert a \"POLLER_SYNC seq=N time=T\" marker into ftrace\n"
+                          "           every SAMPLES samples, T being the timestamp of the\n"
+                          "           sample. These markers allow correcting the drift\n"
+                          "           between the poller and ftrace timestamps over long runs.\n"
+                          "           With only -n files, they are inserted every SAMPLES\n"
+                          "           intervals instead.\n"
                           "    -t     The polling sample interval in microseconds\n"
                           "           Defaults to 1000000 (1 second)\n"
                           "    -l     Comma separated list of labels to use in the CSV\n"
-                          "           output. This should match the number of files\n";
+                          "           output. This should match the number of files\n"
+                          "    -b     Output the values in a compact binary format instead of\n"
+                          "           CSV. Values are parsed as integers, so this is only\n"
+                          "           suitable for files containing a single number.\n"
+                          "    -d     Only output a sample when at least one of the values\n"
+                          "           changed. The last sample is always output on exit.\n"
+                          "    -a     Schedule samples on absolute deadlines, so that the\n"
+                          "           interval does not grow with the time spent reading the\n"
+                          "           files. Missed deadlines and latency percentiles are\n"
+                          "           reported on STDERR on exit.\n"
+                          "    -c     Pin the poller to the given CPU\n"
+                          "    -n     Poll NFILE for changes signaled with sysfs_notify()\n"
+                          "           instead of reading it every interval. A sample is\n"
+                          "           output each time one such file changes. These files come\n"
+                          "           after the periodic FILE(s) in the output. May be repeated.\n";
 
 
     //Handling command line arguments
-    while ((c = getopt(argc, argv, "hmt:l:")) != -1)
+    while ((c = getopt(argc, argv, "hmbdac:n:s:t:l:")) != -1)
     {
         switch(c) {
             case 'h':
@@ -105,6 +466,24 @@ int main(int argc, char ** argv) {
             case 'm':
                 should_write_marker = 1;
 		break;
+            case 's':
+                sync_interval = (unsigned int)atoi(optarg);
+                break;
+            case 'b':
+                binary = 1;
+                break;
+            case 'd':
+                changes_only = 1;
+                break;
+            case 'a':
+                absolute = 1;
+                break;
+            case 'c':
+                cpu = atoi(optarg);
+                break;
+            case 'n':
+                notify_paths[num_notify++] = optarg;
+                break;
             case 't':
                 interval = (useconds_t)atoi(optarg);
                 break;
@@ -122,14 +501,19 @@ int main(int argc, char ** argv) {
         exit(1);
     }
 
-    if (optind >= argc) {
+    if (optind >= argc && !num_notify) {
         fprintf(stderr, "ERROR: %s: missing file path(s)\n", argv[0]);
         fprintf(stderr, usage, argv[0]);
         exit(1);
     }
 
-    int num_files = argc - optind;
+    output_flags = (binary ? OUTPUT_BINARY : 0) | (changes_only ? OUTPUT_CHANGES : 0);
+
+    int num_periodic = argc - optind;
+    int num_files = num_periodic + num_notify;
     poll_source_t files_to_poll[num_files];
+    struct pollfd pfds[num_notify ? num_notify : 1];
+    poll_source_t *pfd_sources[num_notify ? num_notify : 1];
 
     if (labelCount && labelCount != num_files)
     {
@@ -139,16 +523,31 @@ int main(int argc, char ** argv) {
         exit(1);
     }
 
-    //Print headers and open files to poll
-    printf("time");
-    if(labelCount)
-    {
-        printf(",%s", labels);
+    if (cpu >= 0) {
+        ret = pin_to_cpu(cpu);
+        if (ret < 0) {
+            fprintf(stderr, "ERROR: Could not pin to CPU %d, got: %s\n", cpu, strerror(-ret));
+            exit(2);
+        }
     }
+
+    if (should_write_marker || sync_interval) {
+        ret = open_trace_marker();
+        if (ret < 0) {
+            fprintf(stderr, "ERROR: Could not open trace_marker, got: %s\n", strerror(-ret));
+            exit(2);
+        }
+    }
+
+    //Open files to poll
     int i;
     for (i = 0; i < num_files; i++)
     {
-        files_to_poll[i].path = argv[optind + i];
+        files_to_poll[i].notify = i >= num_periodic;
+        files_to_poll[i].len = 0;
+        files_to_poll[i].changed = 1;
+        files_to_poll[i].path = files_to_poll[i].notify ? notify_paths[i - num_periodic] : argv[optind + i];
+        files_to_poll[i].label = labelCount ? strsep(&labels, ",") : files_to_poll[i].path;
         files_to_poll[i].fd = open(files_to_poll[i].path, O_RDONLY);
         if (files_to_poll[i].fd == -1) {
             fprintf(stderr, "ERROR: Could not open \"%s\", got: %s\n",
@@ -156,11 +555,30 @@ int main(int argc, char ** argv) {
             exit(2);
         }
 
-        if(!labelCount) {
-            printf(",%s", argv[optind + i]);
+        if (files_to_poll[i].notify) {
+            pfds[i - num_periodic].fd = files_to_poll[i].fd;
+            pfds[i - num_periodic].events = POLLPRI | POLLERR;
+            pfd_sources[i - num_periodic] = &files_to_poll[i];
         }
     }
-    printf("\n");
+
+    //Print headers
+    if (binary) {
+        binary_header_t header;
+
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, BINARY_MAGIC, sizeof(header.magic));
+        header.version = BINARY_VERSION;
+        header.num_files = num_files;
+        output_append(&header, sizeof(header));
+        for (i = 0; i < num_files; i++)
+            output_append(files_to_poll[i].label, strlen(files_to_poll[i].label) + 1);
+    } else {
+        output_printf("time");
+        for (i = 0; i < num_files; i++)
+            output_printf(",%s", files_to_poll[i].label);
+        output_printf("\n");
+    }
 
     //Setup SIGTERM handler
     struct sigaction action;
@@ -168,41 +586,91 @@ int main(int argc, char ** argv) {
     action.sa_handler = term;
     sigaction(SIGTERM, &action, NULL);
 
-    //Poll files 
-    int bytes_read = 0;
+    //Poll files
+    int64_t interval_ns = (int64_t)interval * NSEC_PER_USEC;
+    int64_t wait_deadline;
+    // Without periodic files, only changes need to be recorded. The main loop
+    // then only wakes up for the sync markers, every sync_interval intervals.
+    int notify_only = num_notify && !num_periodic;
+    if (notify_only)
+        absolute = 0;
+
+    // sysfs_notify() only wakes up poll() once the value has been read
+    for (i = num_periodic; i < num_files; i++)
+        read_source(&files_to_poll[i]);
+
+    clock_gettime(CLOCK_BOOTTIME, &current_time);
+    deadline = timespec_to_ns(&current_time);
     while (!done) {
         clock_gettime(CLOCK_BOOTTIME, &current_time);
-        if (should_write_marker) {
+        if (absolute)
+            latency_hist_add(&wakeup_latency, timespec_to_ns(&current_time) - deadline);
+        if (should_write_marker && !sample_count) {
             ret = write_trace_marker("POLLER_START", 12);
             if (ret < 0) {
-                fprintf(stderr, "ERROR writing trace marker: %s\n", strerror(ret));
-                exit(ret);
+                fprintf(stderr, "ERROR writing trace marker: %s\n", strerror(-ret));
+                exit(2);
             }
         }
+        if (sync_interval && (notify_only || !(sample_count % sync_interval))) {
+            ret = snprintf(marker, sizeof(marker), "POLLER_SYNC seq=%lu time=%lld.%09ld",
+                           sync_seq++, (long long)current_time.tv_sec, current_time.tv_nsec);
+            ret = write_trace_marker(marker, ret);
+            if (ret < 0)
+                fprintf(stderr, "WARNING: Could not write sync marker: %s\n", strerror(-ret));
+        }
+        // In notify-only mode, the initial values are the only sample not
+        // triggered by a change
+        if (!notify_only || !sample_count) {
+            for (i = 0; i < num_periodic; i++)
+                read_source(&files_to_poll[i]);
+            output_sample(files_to_poll, num_files, &current_time, output_flags);
+        }
+        sample_count++;
 
-        time_float = (double)current_time.tv_sec;
-        time_float += ((double)current_time.tv_nsec)/1000/1000/1000;
-        printf("%f", time_float);
-        for (i = 0; i < num_files; i++) {
-            lseek(files_to_poll[i].fd, 0, SEEK_SET);
-            bytes_read = read(files_to_poll[i].fd, buf, 1024);
+        clock_gettime(CLOCK_BOOTTIME, &end_time);
+        if (absolute) {
+            latency_hist_add(&sample_duration,
+                             timespec_to_ns(&end_time) - timespec_to_ns(&current_time));
 
-            if (bytes_read < 0) {
-                fprintf(stderr, "WARNING: Read nothing from \"%s\"\n",
-                        files_to_poll[i].path);
-                printf(",");
-                continue;
+            // Skip the deadlines we overran rather than sampling in a burst
+            deadline += interval_ns;
+            if (timespec_to_ns(&end_time) >= deadline) {
+                int64_t late = (timespec_to_ns(&end_time) - deadline) / interval_ns + 1;
+                deadline += late * interval_ns;
+                missed += late;
             }
-
-            strip(buf);
-            printf(",%s", buf);
-            memset(buf, 0, sizeof(buf)); // "Empty" buffer
+        } else {
+            deadline = timespec_to_ns(&end_time) + interval_ns;
         }
-        printf("\n");
-        usleep(interval);
+
+        if (notify_only)
+            wait_deadline = sync_interval ?
+                            timespec_to_ns(&end_time) + interval_ns * sync_interval : -1;
+        else
+            wait_deadline = deadline;
+
+        if (num_notify)
+            wait_for_events(files_to_poll, num_files, pfds, pfd_sources, num_notify,
+                            wait_deadline, output_flags);
+        else if (absolute)
+            sleep_until(deadline);
+        else
+            usleep(interval);
+    }
+    output_final_sample(files_to_poll, num_files, output_flags);
+    output_flush();
+
+    if (absolute) {
+        if (missed)
+            fprintf(stderr, "WARNING: missed %lld sampling deadlines\n", (long long)missed);
+        latency_hist_report(&wakeup_latency);
+        latency_hist_report(&sample_duration);
     }
 
     //Close files
+    if (trace_marker_fd >= 0)
+        close(trace_marker_fd);
     for (i = 0; i < num_files; i++)
     {
         close(files_to_poll[i].fd);
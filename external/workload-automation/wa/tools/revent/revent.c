@@ -13,10 +13,12 @@
  * limitations under the License.
  */
 
+#define _GNU_SOURCE
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -25,6 +27,7 @@
 #include <time.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <linux/input.h>
 #include <linux/uinput.h>
@@ -45,15 +48,42 @@
 #define KEY_BITS_SIZE (KEY_MAX / 8 + 1)
 
 
+#define NSEC_PER_SEC 1000000000ULL
+#define NSEC_PER_USEC 1000ULL
+
+// Maximum number of events submitted to a device with a single write() on replay
+#define REPLAY_BATCH_SIZE 64
+
+// Maximum number of events read from a device with a single read() on record
+#define RECORD_READ_BATCH_SIZE 64
+// Number of events buffered in memory before they are written out on record
+#define RECORD_BUFFER_SIZE 4096
+// Interval at which the buffered events and the event count are written out,
+// so that the recording remains usable if revent is killed.
+#define RECORD_CHECKPOINT_INTERVAL NSEC_PER_SEC
+
 #define HEADER_PADDING_SIZE 6
 #define EVENT_PADDING_SIZE 4
 
+// Starting with version 4, the event section is aligned to this many bytes
+// from the start of the file, so that it may be mapped and used in place.
+#define EVENT_ALIGNMENT 8
+
 const char MAGIC[] = "REVENT";
 
 // NOTE: This should be incremented if any changes are made to the file format.
 //       Should that be the case, also make sure to update the format description
 //       in doc/source/revent.rst and the Python parser in wa/utils/revent.py.
-uint16_t FORMAT_VERSION = 3;
+uint16_t FORMAT_VERSION = 5;
+
+// Recordings are written in the packed format, which can be replayed in place.
+// The compressed format is smaller but has to be decoded before replay.
+#define PACKED_FORMAT_VERSION 4
+#define COMPRESSED_FORMAT_VERSION 5
+
+// Upper bound on the encoded size of an event in a compressed recording: a
+// 64 bit timestamp delta, 16 bit type and code, and a 32 bit value as varints.
+#define MAX_ENCODED_EVENT_SIZE (10 + 3 + 3 + 5)
 
 typedef enum {
 	FALSE=0,
@@ -71,6 +101,7 @@ typedef enum {
 	REPLAY_COMMAND,
 	DUMP_COMMAND,
 	INFO_COMMAND,
+	CONVERT_COMMAND,
 	INVALID_COMMAND
 } revent_command_t;
 
@@ -95,7 +126,11 @@ typedef struct {
 	recording_mode_t mode;
 	int32_t record_time;
 	int32_t device_number;
+	int32_t spin_time;
+	int32_t replay_priority;
+	bool_t compress;
 	char *file;
+	char *out_file;
 } revent_args_t;
 
 typedef struct {
@@ -110,6 +145,20 @@ typedef struct {
 	struct input_event event;
 } replay_event_t;
 
+// On-disk layout of an event in version 4 recordings. All fields are
+// naturally aligned and the stride is fixed, so that an array of these can be
+// mapped directly from the file. Events of older recordings are converted into
+// this layout when they are loaded.
+typedef struct {
+	uint64_t sec;
+	uint32_t usec;
+	uint16_t dev_idx;
+	uint16_t type;
+	uint16_t code;
+	uint16_t reserved;
+	int32_t value;
+} revent_event_t;
+
 typedef struct {
 	uint16_t version;
 	recording_mode_t mode;
@@ -122,9 +171,21 @@ typedef struct {
 	uint64_t num_events;
 	struct timeval start_time;
 	struct timeval end_time;
-	replay_event_t *events;
+	revent_event_t *events;
+	void *map;        // mapping backing events for version 4 recordings
+	size_t map_size;
 } revent_recording_t;
 
+typedef struct {
+	int fd;
+	off_t count_pos;          // offset of the event count in the recording
+	struct timeval start_time;
+	struct timeval end_time;
+	revent_event_t *events;
+	size_t len;               // number of buffered events
+	uint64_t flushed;         // number of events written to the recording
+} record_buffer_t;
+
 bool_t verbose = FALSE;
 bool_t wait_for_stdin = TRUE;
 
@@ -263,24 +324,56 @@ inline void block_sigterm(sigset_t *oldset)
 	sigprocmask(SIG_BLOCK, &sigset, oldset);
 }
 
-// Events are recorded with their original timestamps, but for playback, we
-// want to treat timestamps as deltas from event zero.
-void adjust_timestamps(revent_recording_t *recording)
+static inline uint64_t get_monotonic_ns(void)
 {
-	uint64_t i;
-	struct timeval time_zero, time_delta;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static inline uint64_t timeval_to_ns(const struct timeval *tv)
+{
+	return (uint64_t)tv->tv_sec * NSEC_PER_SEC + (uint64_t)tv->tv_usec * NSEC_PER_USEC;
+}
 
-	time_zero.tv_sec = recording->start_time.tv_sec;
-	time_zero.tv_usec = recording->start_time.tv_usec;
+// Wait until the specified CLOCK_MONOTONIC deadline. The last spin_ns
+// nanoseconds are busy-waited, so that the wakeup latency of the scheduler
+// does not delay the caller past the deadline.
+void wait_until(uint64_t deadline, uint64_t spin_ns)
+{
+	struct timespec ts;
 
-	for(i = 0; i < recording->num_events; i++) {
-		timersub(&recording->events[i].event.time, &time_zero, &time_delta);
-		recording->events[i].event.time.tv_sec = time_delta.tv_sec;
-		recording->events[i].event.time.tv_usec = time_delta.tv_usec;
+	if (deadline > get_monotonic_ns() + spin_ns) {
+		ts.tv_sec = (deadline - spin_ns) / NSEC_PER_SEC;
+		ts.tv_nsec = (deadline - spin_ns) % NSEC_PER_SEC;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+			;
 	}
-	timersub(&recording->end_time, &time_zero, &time_delta);
-	recording->end_time.tv_sec = time_delta.tv_sec;
-	recording->end_time.tv_usec = time_delta.tv_usec;
+
+	while (get_monotonic_ns() < deadline)
+		;
+}
+
+static inline uint64_t revent_event_to_ns(const revent_event_t *ev)
+{
+	return ev->sec * NSEC_PER_SEC + ev->usec * NSEC_PER_USEC;
+}
+
+void replay_event_to_revent_event(const replay_event_t *rev, revent_event_t *ev)
+{
+	memset(ev, 0, sizeof(*ev));
+	ev->sec = (uint64_t)rev->event.time.tv_sec;
+	ev->usec = (uint32_t)rev->event.time.tv_usec;
+	ev->dev_idx = (uint16_t)rev->dev_idx;
+	ev->type = rev->event.type;
+	ev->code = rev->event.code;
+	ev->value = rev->event.value;
+}
+
+int compare_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return x < y ? -1 : x > y;
 }
 
 int write_record_header(int fd, const revent_record_desc_t *desc)
@@ -586,40 +679,265 @@ int read_record_timestamps(FILE *fin, revent_recording_t *recording)
 	return 0;
 }
 
-int write_replay_event(FILE *fout, const replay_event_t *ev)
+int write_record_timestamps(FILE *fout, const struct timeval *start_time,
+			    const struct timeval *end_time)
 {
+	uint64_t times[4];
 	size_t ret;
-	uint64_t time;
 
-	ret = fwrite(&ev->dev_idx, sizeof(uint16_t), 1, fout);
-	if (ret < 1)
-		return errno;
-	
-	time = (uint64_t)ev->event.time.tv_sec;
-	ret = fwrite(&time, sizeof(uint64_t), 1, fout);
-	if (ret < 1)
-		return errno;
+	times[0] = (uint64_t)start_time->tv_sec;
+	times[1] = (uint64_t)start_time->tv_usec;
+	times[2] = (uint64_t)end_time->tv_sec;
+	times[3] = (uint64_t)end_time->tv_usec;
 
-	time = (uint64_t)ev->event.time.tv_usec;
-	ret = fwrite(&time, sizeof(uint64_t), 1, fout);
-	if (ret < 1)
+	ret = fwrite(times, sizeof(uint64_t), 4, fout);
+	if (ret < 4)
 		return errno;
 
-	ret = fwrite(&ev->event.type, sizeof(uint16_t), 1, fout);
-	if (ret < 1)
+	return 0;
+}
+
+// Zero-pad the output up to the start of the (aligned) event section.
+int write_event_section_padding(FILE *fout)
+{
+	char padding[EVENT_ALIGNMENT];
+	long pos;
+	size_t len, ret;
+
+	pos = ftell(fout);
+	if (pos < 0)
 		return errno;
 
-	ret = fwrite(&ev->event.code, sizeof(uint16_t), 1, fout);
-	if (ret < 1)
+	len = (EVENT_ALIGNMENT - pos % EVENT_ALIGNMENT) % EVENT_ALIGNMENT;
+	if (!len)
+		return 0;
+
+	bzero(padding, EVENT_ALIGNMENT);
+	ret = fwrite(padding, 1, len, fout);
+	if (ret < len)
 		return errno;
 
-	ret = fwrite(&ev->event.value, sizeof(uint32_t), 1, fout);
+	return 0;
+}
+
+int write_revent_event(FILE *fout, const revent_event_t *ev)
+{
+	size_t ret;
+
+	ret = fwrite(ev, sizeof(*ev), 1, fout);
 	if (ret < 1)
 		return errno;
 
 	return 0;
 }
 
+static inline size_t put_varint(uint8_t *buf, uint64_t value)
+{
+	size_t len = 0;
+
+	while (value >= 0x80) {
+		buf[len++] = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	buf[len++] = (uint8_t)value;
+	return len;
+}
+
+static inline int get_varint(const uint8_t **pos, const uint8_t *end, uint64_t *value)
+{
+	unsigned int shift = 0;
+	uint8_t byte;
+
+	*value = 0;
+	do {
+		if (*pos == end || shift > 63)
+			return EINVAL;
+		byte = *(*pos)++;
+		*value |= (uint64_t)(byte & 0x7f) << shift;
+		shift += 7;
+	} while (byte & 0x80);
+	return 0;
+}
+
+static inline uint64_t zigzag_encode(int64_t value)
+{
+	return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t zigzag_decode(uint64_t value)
+{
+	return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static inline uint64_t revent_event_to_us(const revent_event_t *ev)
+{
+	return ev->sec * 1000000ULL + ev->usec;
+}
+
+uint32_t get_num_streams(const revent_recording_t *recording)
+{
+	if (recording->desc.mode == GENERAL_MODE)
+		return recording->devices.num;
+	return 1;
+}
+
+// The compressed event section holds one stream per device. Each is prefixed
+// with its number of events and length in bytes, and each event within it is
+// encoded as varints: the zigzag'd timestamp delta (in uS) from the previous
+// event of the stream (or the recording's start time), type, code, and the
+// zigzag'd value.
+int write_compressed_events(FILE *fout, const revent_recording_t *recording)
+{
+	uint32_t num_streams = get_num_streams(recording);
+	uint64_t i, count, prev, ts;
+	uint8_t *buf, *pos;
+	uint64_t len;
+	uint32_t dev;
+	int ret = 0;
+
+	if (fwrite(&num_streams, sizeof(uint32_t), 1, fout) < 1)
+		return errno;
+
+	for (i = 0; i < recording->num_events; i++)
+		if (recording->events[i].dev_idx >= num_streams)
+			return EINVAL;
+
+	buf = malloc(MAX_ENCODED_EVENT_SIZE * (recording->num_events ? recording->num_events : 1));
+	if (buf == NULL)
+		return ENOMEM;
+
+	for (dev = 0; dev < num_streams; dev++) {
+		pos = buf;
+		count = 0;
+		prev = (uint64_t)recording->start_time.tv_sec * 1000000ULL +
+			recording->start_time.tv_usec;
+		for (i = 0; i < recording->num_events; i++) {
+			const revent_event_t *ev = &recording->events[i];
+			if (ev->dev_idx != dev)
+				continue;
+			ts = revent_event_to_us(ev);
+			pos += put_varint(pos, zigzag_encode((int64_t)(ts - prev)));
+			pos += put_varint(pos, ev->type);
+			pos += put_varint(pos, ev->code);
+			pos += put_varint(pos, zigzag_encode(ev->value));
+			prev = ts;
+			count++;
+		}
+
+		len = pos - buf;
+		if (fwrite(&count, sizeof(uint64_t), 1, fout) < 1 ||
+		    fwrite(&len, sizeof(uint64_t), 1, fout) < 1 ||
+		    (len && fwrite(buf, 1, len, fout) < len)) {
+			ret = errno;
+			break;
+		}
+	}
+
+	free(buf);
+	return ret;
+}
+
+int decode_event_stream(const uint8_t *pos, const uint8_t *end, uint16_t dev,
+			uint64_t ts, revent_event_t *events, uint64_t count)
+{
+	uint64_t i, delta, type, code, value;
+
+	for (i = 0; i < count; i++) {
+		if (get_varint(&pos, end, &delta) || get_varint(&pos, end, &type) ||
+		    get_varint(&pos, end, &code) || get_varint(&pos, end, &value))
+			return EINVAL;
+		ts += zigzag_decode(delta);
+		memset(&events[i], 0, sizeof(events[i]));
+		events[i].sec = ts / 1000000ULL;
+		events[i].usec = ts % 1000000ULL;
+		events[i].dev_idx = dev;
+		events[i].type = type;
+		events[i].code = code;
+		events[i].value = (int32_t)zigzag_decode(value);
+	}
+	return pos == end ? 0 : EINVAL;
+}
+
+// Decode the per-device streams and merge them back into a single stream,
+// ordered by timestamp. Events of different devices with identical
+// timestamps are ordered by device index.
+int read_compressed_events(FILE *fin, revent_recording_t *recording)
+{
+	uint32_t num_streams, dev;
+	uint64_t total = 0, count, len, i, start;
+	uint64_t offsets[INPDEV_MAX_DEVICES + 1], heads[INPDEV_MAX_DEVICES];
+	revent_event_t *decoded = NULL;
+	uint8_t *buf = NULL;
+	int ret = 0;
+
+	if (fread(&num_streams, sizeof(uint32_t), 1, fin) < 1)
+		return EIO;
+	if (num_streams != get_num_streams(recording) || num_streams > INPDEV_MAX_DEVICES)
+		return EINVAL;
+
+	decoded = malloc(sizeof(revent_event_t) * (recording->num_events ? recording->num_events : 1));
+	recording->events = malloc(sizeof(revent_event_t) * (recording->num_events ? recording->num_events : 1));
+	if (decoded == NULL || recording->events == NULL) {
+		ret = ENOMEM;
+		goto out;
+	}
+
+	start = (uint64_t)recording->start_time.tv_sec * 1000000ULL +
+		recording->start_time.tv_usec;
+	for (dev = 0; dev < num_streams; dev++) {
+		if (fread(&count, sizeof(uint64_t), 1, fin) < 1 ||
+		    fread(&len, sizeof(uint64_t), 1, fin) < 1) {
+			ret = EIO;
+			goto out;
+		}
+		if (count > recording->num_events - total ||
+		    len > count * MAX_ENCODED_EVENT_SIZE) {
+			ret = EINVAL;
+			goto out;
+		}
+
+		free(buf);
+		buf = malloc(len ? len : 1);
+		if (buf == NULL) {
+			ret = ENOMEM;
+			goto out;
+		}
+		if (len && fread(buf, 1, len, fin) < len) {
+			ret = EIO;
+			goto out;
+		}
+
+		ret = decode_event_stream(buf, buf + len, dev, start, decoded + total, count);
+		if (ret)
+			goto out;
+		offsets[dev] = total;
+		heads[dev] = total;
+		total += count;
+	}
+	offsets[num_streams] = total;
+	if (total != recording->num_events) {
+		ret = EINVAL;
+		goto out;
+	}
+
+	for (i = 0; i < total; i++) {
+		int best = -1;
+		for (dev = 0; dev < num_streams; dev++) {
+			if (heads[dev] == offsets[dev + 1])
+				continue;
+			if (best < 0 || revent_event_to_us(&decoded[heads[dev]]) <
+					revent_event_to_us(&decoded[heads[best]]))
+				best = dev;
+		}
+		recording->events[i] = decoded[heads[best]++];
+	}
+
+out:
+	free(buf);
+	free(decoded);
+	return ret;
+}
+
 int read_replay_event(FILE *fin, replay_event_t *ev)
 {
 	size_t ret;
@@ -712,9 +1030,95 @@ int open_revent_recording(const char *filepath, revent_record_desc_t *desc, FILE
 	return 0;
 }
 
-FILE *init_recording(const char *pathname, recording_mode_t mode)
+int init_record_buffer(record_buffer_t *buf, int fd, off_t count_pos)
+{
+	memset(buf, 0, sizeof(*buf));
+	buf->fd = fd;
+	buf->count_pos = count_pos;
+	buf->events = malloc(sizeof(revent_event_t) * RECORD_BUFFER_SIZE);
+	if (buf->events == NULL)
+		return ENOMEM;
+	return 0;
+}
+
+void fini_record_buffer(record_buffer_t *buf)
+{
+	free(buf->events);
+	buf->events = NULL;
+	buf->len = 0;
+}
+
+int record_buffer_flush(record_buffer_t *buf)
+{
+	const char *data = (const char *)buf->events;
+	size_t left = sizeof(revent_event_t) * buf->len;
+	ssize_t ret;
+
+	while (left) {
+		ret = write(buf->fd, data, left);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		data += ret;
+		left -= ret;
+	}
+	buf->flushed += buf->len;
+	buf->len = 0;
+	return 0;
+}
+
+int record_buffer_add(record_buffer_t *buf, const revent_event_t *ev)
+{
+	int ret;
+
+	if (buf->len == RECORD_BUFFER_SIZE) {
+		ret = record_buffer_flush(buf);
+		if (ret)
+			return ret;
+	}
+	buf->events[buf->len++] = *ev;
+	return 0;
+}
+
+// Write out the buffered events, then update the event count and timestamps
+// so that the recording is valid up to this point.
+int record_buffer_finalize(record_buffer_t *buf)
+{
+	uint64_t header[5];
+	ssize_t ret;
+
+	ret = record_buffer_flush(buf);
+	if (ret)
+		return ret;
+
+	header[0] = buf->flushed;
+	header[1] = (uint64_t)buf->start_time.tv_sec;
+	header[2] = (uint64_t)buf->start_time.tv_usec;
+	header[3] = (uint64_t)buf->end_time.tv_sec;
+	header[4] = (uint64_t)buf->end_time.tv_usec;
+	ret = pwrite(buf->fd, header, sizeof(header), buf->count_pos);
+	if (ret < 0)
+		return errno;
+	if (ret < sizeof(header))
+		return EIO;
+	return 0;
+}
+
+int record_buffer_checkpoint(record_buffer_t *buf)
 {
-	revent_record_desc_t desc = { .mode = mode, .version = FORMAT_VERSION };
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	buf->end_time.tv_sec = now.tv_sec;
+	buf->end_time.tv_usec = now.tv_nsec / 1000;
+	return record_buffer_finalize(buf);
+}
+
+FILE *init_recording(const char *pathname, recording_mode_t mode, uint16_t version)
+{
+	revent_record_desc_t desc = { .mode = mode, .version = version };
 
 	FILE *fh = fopen(pathname, "w");
 	if (fh == NULL)
@@ -880,6 +1284,8 @@ void init_revent_recording(revent_recording_t *recording)
 	recording->desc.version = 0;
 	recording->desc.mode = INVALID_MODE;
 	recording->events = NULL;
+	recording->map = NULL;
+	recording->map_size = 0;
 	recording->gamepad_info = NULL;
 	init_input_devices(&recording->devices);
 }
@@ -895,9 +1301,13 @@ void fini_revent_recording(revent_recording_t *recording)
 		// We're finalizing the recording so at this point,
 		// we don't care.
 	}
-	if (recording->num_events) {
+	if (recording->map) {
+		munmap(recording->map, recording->map_size);
+		recording->map = NULL;
+	} else if (recording->events) {
 		free(recording->events);
 	}
+	recording->events = NULL;
 	recording->num_events = 0;
 	recording->desc.version = 0;
 	recording->desc.mode = INVALID_MODE;
@@ -983,12 +1393,29 @@ int create_replay_device_or_die(const device_info_t *info)
 	return fd;
 }
 
+// Use the timestamps of the first and last events as the start and end times
+// of recordings that predate version 3.
+void set_times_from_events(revent_recording_t *recording)
+{
+	if (!recording->num_events) {
+		timerclear(&recording->start_time);
+		timerclear(&recording->end_time);
+		return;
+	}
+
+	recording->start_time.tv_sec = recording->events[0].sec;
+	recording->start_time.tv_usec = recording->events[0].usec;
+	recording->end_time.tv_sec = recording->events[recording->num_events - 1].sec;
+	recording->end_time.tv_usec = recording->events[recording->num_events - 1].usec;
+}
+
 inline void read_revent_recording_or_die(const char *filepath, revent_recording_t *recording)
 {
 	int ret;
 	FILE *fin;
 	uint64_t i;
-	off_t fsize;
+	off_t fsize, pos;
+	replay_event_t rev;
 
 	ret = open_revent_recording(filepath, &recording->desc, &fin);
 	if (ret) {
@@ -1019,7 +1446,48 @@ inline void read_revent_recording_or_die(const char *filepath, revent_recording_
 		die("Unexpected recording mode: %d", recording->desc.mode);
 	}
 
-	if (recording->desc.version > 1) {
+	if (recording->desc.version > 4) {
+		ret = fread(&recording->num_events, sizeof(uint64_t), 1, fin);
+		if (ret < 1)
+			die("Could not read the number of recorded events");
+
+		ret = read_record_timestamps(fin, recording);
+		if (ret)
+			die("Could not read recroding timestamps.");
+
+		ret = read_compressed_events(fin, recording);
+		if (ret)
+			die("%s revent recording appears to be corrupted", filepath);
+	} else if (recording->desc.version > 3) {
+		ret = fread(&recording->num_events, sizeof(uint64_t), 1, fin);
+		if (ret < 1)
+			die("Could not read the number of recorded events");
+
+		ret = read_record_timestamps(fin, recording);
+		if (ret)
+			die("Could not read recroding timestamps.");
+
+		// The events are a fixed-stride array starting at the next
+		// aligned offset; map them rather than reading them in.
+		pos = ftell(fin);
+		pos += (EVENT_ALIGNMENT - pos % EVENT_ALIGNMENT) % EVENT_ALIGNMENT;
+		fsize = get_file_size(filepath);
+		if (fsize < pos ||
+		    (uint64_t)(fsize - pos) / sizeof(revent_event_t) < recording->num_events)
+			die("%s revent recording appears to be truncated", filepath);
+
+		if (recording->num_events) {
+			recording->map_size = (size_t)fsize;
+			recording->map = mmap(NULL, recording->map_size, PROT_READ,
+					      MAP_PRIVATE, fileno(fin), 0);
+			if (recording->map == MAP_FAILED) {
+				recording->map = NULL;
+				die("Could not map %s: %s", filepath, strerror(errno));
+			}
+			madvise(recording->map, recording->map_size, MADV_SEQUENTIAL);
+			recording->events = (revent_event_t *)((char *)recording->map + pos);
+		}
+	} else if (recording->desc.version > 1) {
 		ret = fread(&recording->num_events, sizeof(uint64_t), 1, fin);
 		if (ret < 1)
 			die("Could not read the number of recorded events");
@@ -1030,27 +1498,22 @@ inline void read_revent_recording_or_die(const char *filepath, revent_recording_
 				die("Could not read recroding timestamps.");
 		}
 
-		recording->events = malloc(sizeof(replay_event_t) * recording->num_events);
-		if (recording->events == NULL)
+		recording->events = malloc(sizeof(revent_event_t) * recording->num_events);
+		if (recording->events == NULL && recording->num_events)
 			die("Not enough memory to allocate replay buffer");
 
+		for(i=0; i < recording->num_events; i++) {
+			ret = read_replay_event(fin, &rev);
+			if (ret)
+				die("%s revent recording appears to be corrupted", filepath);
+			replay_event_to_revent_event(&rev, &recording->events[i]);
+		}
+
 		// start/end times tracking for recording as a whole was added in version 3
 		// of recording format; for earlier recordings, use timestamps of the first and
 		// last events.
-		read_replay_event(fin, &recording->events[0]);
-		if (recording->desc.version <= 2) {
-			recording->start_time.tv_sec  = recording->events[0].event.time.tv_sec;
-			recording->start_time.tv_usec  = recording->events[0].event.time.tv_usec;
-		}
-
-		for(i=1; i < recording->num_events; i++) {
-			read_replay_event(fin, &recording->events[i]);
-		}
-
-		if (recording->desc.version <= 2) {
-			recording->end_time.tv_sec  = recording->events[i].event.time.tv_sec;
-			recording->end_time.tv_usec  = recording->events[i].event.time.tv_usec;
-		}
+		if (recording->desc.version <= 2)
+			set_times_from_events(recording);
 	} else {   // backwards compatibility
 		/* Prior to verion 2, the total number of recorded events was not being
 		 * written as part of the recording. We will use the size of the file on
@@ -1061,21 +1524,25 @@ inline void read_revent_recording_or_die(const char *filepath, revent_recording_
 		 */
 		 fsize  = get_file_size(filepath);
 		 recording->events = malloc((size_t)fsize);
+		 if (recording->events == NULL)
+			die("Not enough memory to allocate replay buffer");
 		 i = 0;
 
 		// Safely get file descriptor for fin, by flushing first.
 		fflush(fin);
 
 		 while (1) {
-			ret = read_legacy_replay_event(fileno(fin), &recording->events[i]);
+			ret = read_legacy_replay_event(fileno(fin), &rev);
 			if (ret == EOF) {
 				break;
 			} else if (ret) {
 				die("error reading events: %s", strerror(ret));
 			}
+			replay_event_to_revent_event(&rev, &recording->events[i]);
 			i++;
 		 }
 		 recording->num_events = i;
+		 set_times_from_events(recording);
 	}
 
 	fclose(fin);
@@ -1102,7 +1569,7 @@ void record(const char *filepath, int delay, recording_mode_t mode)
 {
 	int ret;
 	struct timespec start_time, end_time;
-	FILE *fout = init_recording(filepath, mode);
+	FILE *fout = init_recording(filepath, mode, PACKED_FORMAT_VERSION);
 	if (fout == NULL)
 		die("Could not create recording \"%s\": %s", filepath, strerror(errno));
 
@@ -1137,30 +1604,44 @@ void record(const char *filepath, int delay, recording_mode_t mode)
 	block_sigterm(&old_sigset);
 
 	// Write the zero size as a place holder and remember the position in the
-	// file stream, so that it may be updated at the end with the actual event
-	// count. Reserving space for five uint64_t's -- the number of events and
-	// end time stamps.
-	uint64_t event_count = 0;
+	// file stream, so that it may be updated with the actual event count at
+	// each checkpoint. Reserving space for five uint64_t's -- the number of
+	// events and start/end time stamps.
+	uint64_t placeholder[5] = { 0 };
 	long size_pos = ftell(fout);
-	ret = fwrite(&event_count, sizeof(uint64_t), 5, fout);
-	if (ret < 1)
+	ret = fwrite(placeholder, sizeof(uint64_t), 5, fout);
+	if (ret < 5)
 		die("Could not initialise event count: %s", strerror(errno));
+	ret = write_event_section_padding(fout);
+	if (ret)
+		die("Could not write event section padding: %s", strerror(ret));
+	// Events bypass stdio from here on.
+	if (fflush(fout))
+		die("Could not write recording header: %s", strerror(errno));
 
-	char padding[EVENT_PADDING_SIZE];
-	bzero(padding, EVENT_PADDING_SIZE);
+	record_buffer_t buf;
+	ret = init_record_buffer(&buf, fileno(fout), size_pos);
+	if (ret)
+		die("Could not allocate record buffer: %s", strerror(ret));
 
 	fd_set readfds;
 	struct timespec tout;
-	replay_event_t rev;
-	int32_t maxfd = 0;
+	struct input_event batch[RECORD_READ_BATCH_SIZE];
+	revent_event_t ev;
 	int32_t keydev = 0;
-	int i;
+	int i, j, n, nready;
+	uint64_t now, last_input, timeout, next_checkpoint;
+	uint64_t idle_time = (uint64_t)delay * NSEC_PER_SEC;
 	printf("recording...\n");
 
 	errno = 0;
 	signal(SIGINT, exitHandler);
 	
 	clock_gettime(CLOCK_MONOTONIC, &start_time);
+	buf.start_time.tv_sec = start_time.tv_sec;
+	buf.start_time.tv_usec = start_time.tv_nsec / 1000;
+	last_input = get_monotonic_ns();
+	next_checkpoint = last_input + RECORD_CHECKPOINT_INTERVAL;
 	while(1)
 	{
 		FD_ZERO(&readfds);
@@ -1168,41 +1649,57 @@ void record(const char *filepath, int delay, recording_mode_t mode)
 		for (i=0; i < devices.num; i++)
 			FD_SET(devices.fds[i], &readfds);
 
-		/* wait for input */
-		tout.tv_sec = delay;
-		tout.tv_nsec = 0;
+		/* wait for input, but wake up in time for the next checkpoint */
+		now = get_monotonic_ns();
+		if (now - last_input >= idle_time)
+			break;
+		timeout = last_input + idle_time - now;
+		if (next_checkpoint <= now)
+			timeout = 0;
+		else if (next_checkpoint - now < timeout)
+			timeout = next_checkpoint - now;
+		tout.tv_sec = timeout / NSEC_PER_SEC;
+		tout.tv_nsec = timeout % NSEC_PER_SEC;
 
-		ret = pselect(devices.max_fd + 1, &readfds, NULL, NULL, &tout, &old_sigset);
+		nready = pselect(devices.max_fd + 1, &readfds, NULL, NULL, &tout, &old_sigset);
 
 		if (EXIT){
 			break;
 		}
-		if (errno == EINTR){
+		if (nready < 0 && errno == EINTR){
 			break;
 		}
-		if (!ret){
-			break;
+
+		if (get_monotonic_ns() >= next_checkpoint) {
+			ret = record_buffer_checkpoint(&buf);
+			if (ret)
+				die("Could not write recording checkpoint: %s", strerror(ret));
+			dprintf("checkpoint: %lu events\n", (unsigned long)buf.flushed);
+			next_checkpoint += RECORD_CHECKPOINT_INTERVAL;
 		}
+		if (nready <= 0)
+			continue;
+		last_input = get_monotonic_ns();
 
 		if (wait_for_stdin && FD_ISSET(STDIN_FILENO, &readfds)) {
 			// in this case the key down for the return key will be recorded
 			// so we need to up the key up
-			memset(&rev, 0, sizeof(rev));
-			rev.dev_idx = keydev;
-			rev.event.type = EV_KEY;
-			rev.event.code = KEY_ENTER;
-			rev.event.value = 0;
-			gettimeofday(&rev.event.time, NULL);
-			write_replay_event(fout, &rev);
+			struct timespec now_ts;
+			clock_gettime(CLOCK_MONOTONIC, &now_ts);
+			memset(&ev, 0, sizeof(ev));
+			ev.sec = now_ts.tv_sec;
+			ev.usec = now_ts.tv_nsec / 1000;
+			ev.dev_idx = keydev;
+			ev.type = EV_KEY;
+			ev.code = KEY_ENTER;
+			ev.value = 0;
+			record_buffer_add(&buf, &ev);
 
 			// syn
-			memset(&rev, 0, sizeof(rev));
-			rev.dev_idx = keydev;
-			rev.event.type = EV_SYN;
-			rev.event.code = 0;
-			rev.event.value = 0;
-			gettimeofday(&rev.event.time, NULL);
-			write_replay_event(fout, &rev);
+			ev.type = EV_SYN;
+			ev.code = 0;
+			ev.value = 0;
+			record_buffer_add(&buf, &ev);
 
 			dprintf("added fake return exiting...\n");
 			break;
@@ -1212,39 +1709,45 @@ void record(const char *filepath, int delay, recording_mode_t mode)
 		{
 			if (FD_ISSET(devices.fds[i], &readfds))
 			{
-				dprintf("got event from %s\n", devices.paths[i]);
-				memset(&rev, 0, sizeof(rev));
-				rev.dev_idx = i;
-				ret = read(devices.fds[i], (void *)&rev.event, sizeof(rev.event));
-				dprintf("%d event: type %d code %d value %d\n",
-						(unsigned int)ret, rev.event.type, rev.event.code, rev.event.value);
-				if (rev.event.type == EV_KEY && rev.event.code == KEY_ENTER && rev.event.value == 1)
-					keydev = i;
-				write_replay_event(fout, &rev);
-				event_count++;
+				// Drain everything the device has queued (up to a
+				// batch) with a single read.
+				n = read(devices.fds[i], batch, sizeof(batch));
+				if (n < 0) {
+					if (errno == EINTR || errno == EAGAIN)
+						continue;
+					die("Could not read from %s: %s", devices.paths[i], strerror(errno));
+				}
+				n /= sizeof(struct input_event);
+				dprintf("got %d events from %s\n", n, devices.paths[i]);
+				for (j = 0; j < n; j++) {
+					dprintf("event: type %d code %d value %d\n",
+							batch[j].type, batch[j].code, batch[j].value);
+					if (batch[j].type == EV_KEY && batch[j].code == KEY_ENTER && batch[j].value == 1)
+						keydev = i;
+					memset(&ev, 0, sizeof(ev));
+					ev.sec = (uint64_t)batch[j].time.tv_sec;
+					ev.usec = (uint32_t)batch[j].time.tv_usec;
+					ev.dev_idx = i;
+					ev.type = batch[j].type;
+					ev.code = batch[j].code;
+					ev.value = batch[j].value;
+					ret = record_buffer_add(&buf, &ev);
+					if (ret)
+						die("Could not write events: %s", strerror(ret));
+				}
 			}
 		}
 	}
 	clock_gettime(CLOCK_MONOTONIC, &end_time);
 
-	dprintf("Writing event count...\n");
-	if ((ret = fseek(fout, size_pos, SEEK_SET)) == -1)
-		die("Could not write event count: %s", strerror(errno));
-	ret = fwrite(&event_count, sizeof(uint64_t), 1, fout);
-	if (ret < 1)
-		die("Could not write event count: %s", strerror(errno));
-	dprintf("Writing recording timestamps...\n");
-	uint64_t secs, usecs;
-	secs = start_time.tv_sec;
-	fwrite(&secs, sizeof(uint64_t), 1, fout);
-	usecs = start_time.tv_nsec / 1000;
-	fwrite(&usecs, sizeof(uint64_t), 1, fout);
-	secs = end_time.tv_sec;
-	fwrite(&secs, sizeof(uint64_t), 1, fout);
-	usecs = end_time.tv_nsec / 1000;
-	ret = fwrite(&usecs, sizeof(uint64_t), 1, fout);
-	if (ret < 1)
-		die("Could not write recording timestamps: %s\n", strerror(errno));
+	dprintf("Writing event count and recording timestamps...\n");
+	buf.end_time.tv_sec = end_time.tv_sec;
+	buf.end_time.tv_usec = end_time.tv_nsec / 1000;
+	ret = record_buffer_finalize(&buf);
+	if (ret)
+		die("Could not write event count: %s", strerror(ret));
+	dprintf("Recorded %lu events\n", (unsigned long)buf.flushed);
+	fini_record_buffer(&buf);
 
 	fclose(fout);
 	dprintf("Recording complete.\n");
@@ -1286,20 +1789,20 @@ void dump(const char *filepath)
 
 	printf("\nevents:\n");
 	for (i =0; i < recording.num_events; i++) {
-		printf("%ld.%06ld dev: %d type: %d code: %d value %d\n",
-				recording.events[i].event.time.tv_sec,
-				recording.events[i].event.time.tv_usec,
+		printf("%lu.%06u dev: %d type: %d code: %d value %d\n",
+				(unsigned long)recording.events[i].sec,
+				recording.events[i].usec,
 				recording.events[i].dev_idx,
-				recording.events[i].event.type,
-				recording.events[i].event.code,
-				recording.events[i].event.value
+				recording.events[i].type,
+				recording.events[i].code,
+				recording.events[i].value
 		      );
 	}
 
 	fini_revent_recording(&recording);
 }
 
-void replay(const char *filepath)
+void replay(const char *filepath, int32_t spin_time, int32_t priority)
 {
 	revent_recording_t recording;
 	init_revent_recording(&recording);
@@ -1317,77 +1820,161 @@ void replay(const char *filepath)
 	default:
 		die("Unexpected recording mod: %d", recording.desc.mode);
 	}
-	dprintf("Adjusting timestamps\n");
-	adjust_timestamps(&recording);
+	if (priority) {
+		struct sched_param param;
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = priority;
+		if (sched_setscheduler(0, SCHED_FIFO, &param))
+			die("Could not set SCHED_FIFO priority %d: %s", priority, strerror(errno));
+		mlockall(MCL_CURRENT | MCL_FUTURE);
+	}
 
-	struct timeval start_time, now, desired_time, last_event_delta, delta;
-	bzero(&last_event_delta, sizeof(struct timeval));
-	gettimeofday(&start_time, NULL);
+	// Timing error of each group of events sharing a timestamp, in uS
+	uint32_t *errors = malloc(sizeof(uint32_t) * (recording.num_events + 1));
+	if (errors == NULL)
+		die("Not enough memory to allocate timing buffer");
+	uint64_t num_groups = 0;
 
+	uint64_t spin_ns = (uint64_t)spin_time * NSEC_PER_USEC;
+	uint64_t start_time, deadline, now;
+	struct input_event batch[REPLAY_BATCH_SIZE];
+	size_t batch_len;
 	int ret;
 	uint64_t i = 0;
+
+	// Events keep their original timestamps; they are replayed relative to
+	// the start of the recording.
+	uint64_t time_zero = timeval_to_ns(&recording.start_time);
+	uint64_t group_time;
+
+	memset(batch, 0, sizeof(batch));
 	dprintf("Starting payback\n");
+	start_time = get_monotonic_ns();
 	while (i < recording.num_events) {
-		gettimeofday(&now, NULL);
-		timeradd(&start_time, &last_event_delta, &desired_time);
-
-		if (timercmp(&desired_time, &now, >)) {
-			timersub(&desired_time, &now, &delta);
-			useconds_t d = (useconds_t)delta.tv_sec * 1000000 + delta.tv_usec;
-			dprintf("now %u.%u desiredtime %u.%u sleeping %u uS\n",
-					(unsigned int)now.tv_sec,
-					(unsigned int)now.tv_usec,
-					(unsigned int)desired_time.tv_sec,
-					(unsigned int)desired_time.tv_usec,
-					d);
-			usleep(d);
-		}
-
-		int32_t idx = (recording.events[i]).dev_idx;
-		struct input_event ev = (recording.events[i]).event;
-		while(!timercmp(&ev.time, &last_event_delta, !=)) {
-			ret = write(recording.devices.fds[idx], &ev, sizeof(ev));
-			if (ret != sizeof(ev))
+		group_time = revent_event_to_ns(&recording.events[i]);
+
+		deadline = start_time;
+		if (group_time > time_zero)
+			deadline += group_time - time_zero;
+		wait_until(deadline, spin_ns);
+		now = get_monotonic_ns();
+		errors[num_groups++] = (now - deadline) / NSEC_PER_USEC;
+
+		// Submit the consecutive events of the group going to the same
+		// device with a single write(), so that e.g. a multitouch frame
+		// reaches the input subsystem at once.
+		do {
+			int32_t idx = (recording.events[i]).dev_idx;
+			batch_len = 0;
+			do {
+				batch[batch_len].type = recording.events[i].type;
+				batch[batch_len].code = recording.events[i].code;
+				batch[batch_len].value = recording.events[i].value;
+				batch_len++;
+				dprintf("replaying event: type %d code %d value %d\n",
+						recording.events[i].type,
+						recording.events[i].code,
+						recording.events[i].value);
+				i++;
+			} while (i < recording.num_events && batch_len < REPLAY_BATCH_SIZE &&
+				 recording.events[i].dev_idx == idx &&
+				 revent_event_to_ns(&recording.events[i]) == group_time);
+
+			ret = write(recording.devices.fds[idx], batch, sizeof(batch[0]) * batch_len);
+			if (ret != sizeof(batch[0]) * batch_len)
 				die("Could not replay event");
-			dprintf("replayed event: type %d code %d value %d\n", ev.type, ev.code, ev.value);
-
-			i++;
-			if (i >= recording.num_events) {
-				break;
-			}
-			idx = recording.events[i].dev_idx;
-			ev = recording.events[i].event;
-		}
-		last_event_delta = ev.time;
-	}
-
-	timeradd(&start_time, &recording.end_time, &desired_time);
-	gettimeofday(&now, NULL);
-	if (timercmp(&desired_time, &now, >)) {
-		timersub(&desired_time, &now, &delta);
-		useconds_t d = (useconds_t)delta.tv_sec * 1000000 + delta.tv_usec;
-		dprintf("now %u.%u recording end time %u.%u; sleeping %u uS\n",
-				(unsigned int)now.tv_sec,
-				(unsigned int)now.tv_usec,
-				(unsigned int)desired_time.tv_sec,
-				(unsigned int)desired_time.tv_usec,
-				d);
-		usleep(d);
-	}
-	else {
-		dprintf("now %u.%u recording end time %u.%u; no need to sleep\n",
-				(unsigned int)now.tv_sec,
-				(unsigned int)now.tv_usec,
-				(unsigned int)desired_time.tv_sec,
-				(unsigned int)desired_time.tv_usec);
+		} while (i < recording.num_events &&
+			 revent_event_to_ns(&recording.events[i]) == group_time);
 	}
+
+	deadline = start_time;
+	if (timeval_to_ns(&recording.end_time) > time_zero)
+		deadline += timeval_to_ns(&recording.end_time) - time_zero;
+	dprintf("recording end time %lu.%09lu\n",
+			(unsigned long)(deadline / NSEC_PER_SEC),
+			(unsigned long)(deadline % NSEC_PER_SEC));
+	wait_until(deadline, 0);
 	dprintf("Playback complete\n");
 
+	if (num_groups) {
+		uint64_t total = 0;
+		for (i = 0; i < num_groups; i++)
+			total += errors[i];
+		qsort(errors, num_groups, sizeof(uint32_t), compare_u32);
+		printf("replayed %lu events in %lu groups; timing error (uS): "
+		       "mean %lu p50 %u p90 %u p99 %u max %u\n",
+		       (unsigned long)recording.num_events, (unsigned long)num_groups,
+		       (unsigned long)(total / num_groups),
+		       errors[num_groups / 2], errors[num_groups * 9 / 10],
+		       errors[num_groups * 99 / 100], errors[num_groups - 1]);
+	}
+	free(errors);
+
         if (recording.desc.mode == GAMEPAD_MODE)
 		destroy_replay_device(recording.devices.fds[0]);
 	fini_revent_recording(&recording);
 }
 
+void convert(const char *infile, const char *outfile, bool_t compress)
+{
+	int ret;
+	size_t written;
+	uint16_t version = compress ? COMPRESSED_FORMAT_VERSION : PACKED_FORMAT_VERSION;
+	revent_recording_t recording;
+	init_revent_recording(&recording);
+
+	read_revent_recording_or_die(infile, &recording);
+	if (recording.desc.version == version)
+		printf("%s is already at version %u; rewriting it\n", infile, version);
+
+	FILE *fout = init_recording(outfile, recording.desc.mode, version);
+	if (fout == NULL)
+		die("Could not create recording \"%s\": %s", outfile, strerror(errno));
+
+	if (recording.desc.mode == GENERAL_MODE) {
+		ret = write_general_input_devices(&recording.devices, fout);
+		if (ret)
+			die("Could not write input devices: %s", strerror(ret));
+	} else if (recording.desc.mode == GAMEPAD_MODE) {
+		ret = write_device_info(fout, recording.gamepad_info);
+		if (ret)
+			die("Problem writing gamepad info: %s", strerror(ret));
+	} else {
+		die("Unexpected recording type: %d", recording.desc.mode);
+	}
+
+	ret = fwrite(&recording.num_events, sizeof(uint64_t), 1, fout);
+	if (ret < 1)
+		die("Could not write event count: %s", strerror(errno));
+	ret = write_record_timestamps(fout, &recording.start_time, &recording.end_time);
+	if (ret)
+		die("Could not write recording timestamps: %s", strerror(ret));
+
+	if (compress) {
+		ret = write_compressed_events(fout, &recording);
+		if (ret)
+			die("Could not write events: %s", strerror(ret));
+	} else {
+		ret = write_event_section_padding(fout);
+		if (ret)
+			die("Could not write event section padding: %s", strerror(ret));
+
+		if (recording.num_events) {
+			written = fwrite(recording.events, sizeof(revent_event_t),
+					 recording.num_events, fout);
+			if (written < recording.num_events)
+				die("Could not write events: %s", strerror(errno));
+		}
+	}
+
+	if (fclose(fout))
+		die("Could not write \"%s\": %s", outfile, strerror(errno));
+	dprintf("Converted %lu events to version %u\n",
+		(unsigned long)recording.num_events, version);
+
+	fini_revent_recording(&recording);
+}
+
 void info(void)
 {
 	input_devices_t devices;
@@ -1429,6 +2016,8 @@ void usage()
 			"        record [-t SECONDS] [-d DEVICE] FILE\n"
 			"            Record input event. stops after return on STDIN (or, optionally, \n"
 			"            a fixed delay)\n"
+			"            The recording is checkpointed once a second, so that it remains\n"
+			"            usable up to the last checkpoint if revent is killed.\n"
 			"\n"
 			"                FILE       file into which events will be recorded.\n"
 			"                -t SECONDS time, in seconds, for which to record events.\n"
@@ -1451,10 +2040,18 @@ void usage()
 			"                           into it. This type of recording should be more\n"
 			"                           portable across different devices.\n"
 			"\n"
-			"        replay FILE\n"
+			"        replay [-b USECS] [-p PRIORITY] FILE\n"
 			"            replays previously recorded events from the specified file.\n"
+			"            Events are replayed on absolute deadlines from the start of\n"
+			"            the playback, and the timing error is reported at the end.\n"
 			"\n"
 			"                FILE       file into which events will be recorded.\n"
+			"                -b USECS   busy-wait for the last USECS microseconds before\n"
+			"                           each event rather than sleeping, to avoid the\n"
+			"                           scheduler wakeup latency.\n"
+			"                -p PRIORITY\n"
+			"                           replay with the SCHED_FIFO policy and the\n"
+			"                           specified priority.\n"
 			"\n"
 			"        dump FILE\n"
 			"            dumps the contents of the specified event log to STDOUT in\n"
@@ -1465,6 +2062,16 @@ void usage()
 			"        info\n"
 			"             shows info about each event char device\n"
 			"\n"
+			"        convert [-z] INFILE OUTFILE\n"
+			"            converts a recording of any format version into the packed\n"
+			"            format written by \"record\", which is mapped into memory\n"
+			"            and replayed in place rather than being read in event by\n"
+			"            event.\n"
+			"\n"
+			"                -z         write the compressed format instead. It is\n"
+			"                           considerably smaller, but is decoded into\n"
+			"                           memory before replay.\n"
+			"\n"
 			);
 }
 
@@ -1476,10 +2083,14 @@ void revent_args_init(revent_args_t **rargs, int argc, char** argv)
 	revent_args->mode = GENERAL_MODE;
 	revent_args->record_time = INT_MAX;
 	revent_args->device_number = -1;
+	revent_args->spin_time = -1;
+	revent_args->replay_priority = -1;
+	revent_args->compress = FALSE;
 	revent_args->file = NULL;
+	revent_args->out_file = NULL;
 
 	int opt;
-	while ((opt = getopt(argc, argv, "hgt:d:vs")) != -1)
+	while ((opt = getopt(argc, argv, "hgt:d:vsb:p:z")) != -1)
 	{
 		switch (opt) {
 			case 'h':
@@ -1505,12 +2116,31 @@ void revent_args_init(revent_args_t **rargs, int argc, char** argv)
 					die("-d parameter must be numeric; got %s.", optarg);
 				}
 				break;
+			case 'b':
+				if (is_numeric(optarg)) {
+					revent_args->spin_time = atoi(optarg);
+					dprintf("busy-wait: %d\n", revent_args->spin_time);
+				} else {
+					die("-b parameter must be numeric; got %s.", optarg);
+				}
+				break;
+			case 'p':
+				if (is_numeric(optarg)) {
+					revent_args->replay_priority = atoi(optarg);
+					dprintf("priority: %d\n", revent_args->replay_priority);
+				} else {
+					die("-p parameter must be numeric; got %s.", optarg);
+				}
+				break;
 			case 'v':
 				verbose = TRUE;
 				break;
 			case 's':
 				wait_for_stdin = FALSE;
 				break;
+			case 'z':
+				revent_args->compress = TRUE;
+				break;
 
 			default:
 				die("Unexpected option: %c", opt);
@@ -1530,6 +2160,8 @@ void revent_args_init(revent_args_t **rargs, int argc, char** argv)
 		revent_args->command = DUMP_COMMAND;
 	else if (!strcmp(argv[next_arg], "info"))
 		revent_args->command = INFO_COMMAND;
+	else if (!strcmp(argv[next_arg], "convert"))
+		revent_args->command = CONVERT_COMMAND;
 	else {
 		usage();
 		die("Unknown command -- %s", argv[next_arg]);
@@ -1540,6 +2172,11 @@ void revent_args_init(revent_args_t **rargs, int argc, char** argv)
 		revent_args->file = argv[next_arg];
 		dprintf("file: %s\n", revent_args->file);
 		next_arg++;
+		if ((revent_args->command == CONVERT_COMMAND) && (next_arg != argc)) {
+			revent_args->out_file = argv[next_arg];
+			dprintf("output file: %s\n", revent_args->out_file);
+			next_arg++;
+		}
 		if (next_arg != argc) {
 			die("Trailling arguments (use -h for help).");
 		}
@@ -1551,6 +2188,15 @@ void revent_args_init(revent_args_t **rargs, int argc, char** argv)
 	if ((revent_args->command != RECORD_COMMAND) && (revent_args->device_number != -1)) {
 		die("-d parameter is only valid for \"record\" command.");
 	}
+	if ((revent_args->command != REPLAY_COMMAND) && (revent_args->spin_time != -1)) {
+		die("-b parameter is only valid for \"replay\" command.");
+	}
+	if ((revent_args->command != REPLAY_COMMAND) && (revent_args->replay_priority != -1)) {
+		die("-p parameter is only valid for \"replay\" command.");
+	}
+	if ((revent_args->command != CONVERT_COMMAND) && revent_args->compress) {
+		die("-z parameter is only valid for \"convert\" command.");
+	}
 	if ((revent_args->command == INFO_COMMAND) && (revent_args->file != NULL)) {
 		die("File path cannot be specified for \"info\" command.");
 	}
@@ -1558,6 +2204,9 @@ void revent_args_init(revent_args_t **rargs, int argc, char** argv)
 			&& (revent_args->file == NULL)) {
 		die("Must specify a file for recording/replaying (use -h for help).");
 	}
+	if ((revent_args->command == CONVERT_COMMAND) && (revent_args->out_file == NULL)) {
+		die("Must specify input and output files for conversion (use -h for help).");
+	}
 }
 
 int revent_args_close(revent_args_t *rargs)
@@ -1579,7 +2228,9 @@ int main(int argc, char** argv)
 			record(rargs->file, rargs->record_time, rargs->mode);
 			break;
 		case REPLAY_COMMAND:
-			replay(rargs->file);
+			replay(rargs->file,
+			       rargs->spin_time == -1 ? 0 : rargs->spin_time,
+			       rargs->replay_priority == -1 ? 0 : rargs->replay_priority);
 			break;
 		case DUMP_COMMAND:
 			dump(rargs->file);
@@ -1587,6 +2238,9 @@ int main(int argc, char** argv)
 		case INFO_COMMAND:
 			info();
 			break;
+		case CONVERT_COMMAND:
+			convert(rargs->file, rargs->out_file, rargs->compress);
+			break;
 		defaut:
 			die("Unexpected revent command: %d", rargs->command);
 	};
@@ -15,6 +15,7 @@
 
 
 import os
+import heapq
 import struct
 import signal
 from datetime import datetime
@@ -45,6 +46,10 @@ absinfo_struct = struct.Struct('<7i')
 
 event_struct = struct.Struct('<HqqHHi')
 old_event_struct = struct.Struct("<i4xqqHHi")  # prior to version 2
+packed_event_struct = struct.Struct('<QIHHH2xi')  # version 4 onwards
+
+EVENT_ALIGNMENT = 8  # of the event section, version 4 onwards
+COMPRESSED_VERSION = 5
 
 
 def read_struct(fh, struct_spec):
@@ -58,6 +63,20 @@ def read_string(fh):
     return read_struct(fh, str_struct)[0]
 
 
+def iter_varints(data):
+    value = shift = 0
+    for byte in bytearray(data):
+        value |= (byte & 0x7f) << shift
+        shift += 7
+        if not byte & 0x80:
+            yield value
+            value = shift = 0
+
+
+def zigzag_decode(value):
+    return (value >> 1) ^ -(value & 1)
+
+
 def count_bits(bitarr):
     return sum(bin(b).count('1') for b in bitarr)
 
@@ -97,11 +116,22 @@ class UinputDeviceInfo(object):
 
 class ReventEvent(object):
 
-    def __init__(self, fh, legacy=False):
-        if not legacy:
+    @classmethod
+    def from_fields(cls, dev_id, ts_sec, ts_usec, type_, code, value):
+        event = cls.__new__(cls)
+        event._set_fields(dev_id, ts_sec, ts_usec, type_, code, value)
+        return event
+
+    def __init__(self, fh, legacy=False, packed=False):
+        if packed:
+            ts_sec, ts_usec, dev_id, type_, code, value = read_struct(fh, packed_event_struct)
+        elif not legacy:
             dev_id, ts_sec, ts_usec, type_, code, value = read_struct(fh, event_struct)
         else:
             dev_id, ts_sec, ts_usec, type_, code, value = read_struct(fh, old_event_struct)
+        self._set_fields(dev_id, ts_sec, ts_usec, type_, code, value)
+
+    def _set_fields(self, dev_id, ts_sec, ts_usec, type_, code, value):
         self.device_id = dev_id
         self.time = datetime.fromtimestamp(ts_sec + float(ts_usec) / 1000000)
         self.type = type_
@@ -206,7 +236,7 @@ class ReventRecording(object):
             raise ValueError(msg.format(self.filepath))
         self.version = version
 
-        if 3 >= self.version >= 2:
+        if COMPRESSED_VERSION >= self.version >= 2:
             self.mode, = read_struct(fh, header_two_struct)
             if self.mode == GENERAL_MODE:
                 self._read_devices(fh)
@@ -219,9 +249,14 @@ class ReventRecording(object):
                 ts_sec = read_struct(fh, u64_struct)[0]
                 ts_usec = read_struct(fh, u64_struct)[0]
                 self.start_time = datetime.fromtimestamp(ts_sec + float(ts_usec) / 1000000)
+                self._start_usec = ts_sec * 1000000 + ts_usec
                 ts_sec = read_struct(fh, u64_struct)[0]
                 ts_usec = read_struct(fh, u64_struct)[0]
                 self.end_time = datetime.fromtimestamp(ts_sec + float(ts_usec) / 1000000)
+            if self.version == 4:
+                # The event section starts at the next aligned offset.
+                padding = -fh.tell() % EVENT_ALIGNMENT
+                fh.seek(padding, os.SEEK_CUR)
 
         elif 2 > self.version >= 0:
             self.mode = GENERAL_MODE
@@ -243,14 +278,38 @@ class ReventRecording(object):
             msg = 'Attempting to iterate over events of a closed recording'
             raise RuntimeError(msg)
         self.fh.seek(self._events_start)
-        if self.version >= 2:
+        if self.version >= COMPRESSED_VERSION:
+            for event in self._iter_compressed_events():
+                yield event
+        elif self.version >= 2:
+            packed = self.version > 3
             for _ in range(self.num_events):
-                yield ReventEvent(self.fh)
+                yield ReventEvent(self.fh, packed=packed)
         else:
             file_size = os.path.getsize(self.filepath)
             while self.fh.tell() < file_size:
                 yield ReventEvent(self.fh, legacy=True)
 
+    def _iter_compressed_events(self):
+        # Each device has its own stream of varint-encoded events, with
+        # timestamps delta-encoded in uS; merge them back by timestamp.
+        num_streams, = read_struct(self.fh, u32_struct)
+        streams = []
+        for dev_id in range(num_streams):
+            count, length = read_struct(self.fh, struct.Struct('<QQ'))
+            values = iter_varints(self.fh.read(length))
+            events = []
+            ts = self._start_usec
+            for _ in range(count):
+                ts += zigzag_decode(next(values))
+                type_, code = next(values), next(values)
+                value = zigzag_decode(next(values))
+                events.append((ts, dev_id, type_, code, value))
+            streams.append(events)
+        for ts, dev_id, type_, code, value in heapq.merge(*streams):
+            yield ReventEvent.from_fields(dev_id, ts // 1000000, ts % 1000000,
+                                          type_, code, value)
+
     def __iter__(self):
         for event in self.events:
             yield event
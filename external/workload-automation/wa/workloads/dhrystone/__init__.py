@@ -18,9 +18,9 @@
 import os
 import re
 
-from wa import Workload, Parameter, ConfigError, Executable
+from wa import Workload, Parameter, ConfigError, Executable, WorkloadError
 from wa.utils.exec_control import once
-from wa.utils.types import cpu_mask
+from wa.utils.types import cpu_mask, list_of_ints
 
 
 class Dhrystone(Workload):
@@ -41,6 +41,8 @@ class Dhrystone(Workload):
     bm_regex = re.compile(r'This machine benchmarks at (?P<score>\d+)')
     dmips_regex = re.compile(r'(?P<score>\d+) DMIPS')
     time_regex = re.compile(r'Total dhrystone run time: (?P<time>[0-9.]+)')
+    thread_regex = re.compile(r'Thread (?P<thread>\d+) \(CPU (?P<cpu>-?\d+)\): '
+                              r'.*wall time for \d+ passes = (?P<time>[0-9.]+)')
 
     default_mloops = 100
 
@@ -71,6 +73,19 @@ class Dhrystone(Workload):
                   pinned to cores as specified by this parameter. The mask can
                   be specified directly as a mask, as a list of cpus or a sysfs-
                   style string '''),
+        Parameter('use_pthreads', kind=bool, default=False,
+                  description='''
+                  Run the dhrystone "threads" as pthreads of a single process,
+                  rather than as forked processes. In this mode, each thread
+                  reports its own wall clock time and score.
+                  '''),
+        Parameter('thread_cpus', kind=list_of_ints, default=None,
+                  description='''
+                  The CPUs to pin the dhrystone threads to. Thread ``i`` is
+                  pinned to ``thread_cpus[i % len(thread_cpus)]``, so e.g.
+                  ``[0, 4]`` with 4 threads places two threads on each of
+                  CPUs 0 and 4.
+                  '''),
     ]
 
     @once
@@ -78,6 +93,11 @@ class Dhrystone(Workload):
         resource = Executable(self, self.target.abi, 'dhrystone')
         host_exe = context.get_resource(resource)
         Dhrystone.target_exe = self.target.install(host_exe)
+        # Older builds of the binary silently ignore -p and -c, so check that
+        # they are listed in its help.
+        usage = self.target.execute('{} -h'.format(Dhrystone.target_exe))
+        Dhrystone.supported_options = [option for option in ['-p', '-c']
+                                       if '    {} '.format(option) in usage]
 
     def setup(self, context):
         if self.mloops:
@@ -93,6 +113,19 @@ class Dhrystone(Workload):
                                                     self.target_exe,
                                                     execution_mode,
                                                     self.threads, self.delay)
+        unsupported = []
+        if self.use_pthreads:
+            self.command += ' -p'
+            if '-p' not in Dhrystone.supported_options:
+                unsupported.append('use_pthreads')
+        if self.thread_cpus:
+            self.command += ' -c {}'.format(','.join(map(str, self.thread_cpus)))
+            if '-c' not in Dhrystone.supported_options:
+                unsupported.append('thread_cpus')
+        if unsupported:
+            msg = 'The dhrystone binary on the target does not support {}; ' \
+                  'rebuild it with the Makefile in src/'
+            raise WorkloadError(msg.format(', '.join(unsupported)))
         if self.duration:
             self.timeout = self.duration + self.delay * self.threads + 10
         else:
@@ -125,18 +158,28 @@ class Dhrystone(Workload):
         dmips_count = 0
         total_score = 0
         total_dmips = 0
+        # In pthread mode, the score and DMIPS of each thread follow the line
+        # giving its CPU.
+        classifiers = None
 
         for line in self.output.split('\n'):
             match = self.time_regex.search(line)
             if match:
                 context.add_metric('time', float(match.group('time')), 'seconds',
                                    lower_is_better=True)
+                continue
+            match = self.thread_regex.search(line)
+            if match:
+                metric = 'thread {} time'.format(match.group('thread'))
+                classifiers = {'cpu': int(match.group('cpu'))}
+                context.add_metric(metric, float(match.group('time')), 'seconds',
+                                   lower_is_better=True, classifiers=classifiers)
             else:
                 match = self.bm_regex.search(line)
                 if match:
                     metric = 'thread {} score'.format(score_count)
                     value = int(match.group('score'))
-                    context.add_metric(metric, value)
+                    context.add_metric(metric, value, classifiers=classifiers)
                     score_count += 1
                     total_score += value
                 else:
@@ -144,7 +187,7 @@ class Dhrystone(Workload):
                     if match:
                         metric = 'thread {} DMIPS'.format(dmips_count)
                         value = int(match.group('score'))
-                        context.add_metric(metric, value)
+                        context.add_metric(metric, value, classifiers=classifiers)
                         dmips_count += 1
                         total_dmips += value
 
@@ -399,6 +399,11 @@
  *
  */
 
+/* This file includes itself to compile the benchmark a second time, for the
+ * pthread mode (see the end of the file). Everything but Package 1 is only
+ * compiled in the first pass. */
+#ifndef DHRY_TLS_BODY
+
 /* Accuracy of timings and human fatigue controlled by next two lines */
 /*#define LOOPS	5000		/* Use this for slow or 16 bit machines */
 /*#define LOOPS	50000		/* Use this for slow or 16 bit machines */
@@ -423,6 +428,15 @@
 /* default number of threads that will be spawned */
 #define DEFAULT_THREADS 1
 
+/* maximum number of CPUs in the thread pinning map */
+#define MAX_PIN_CPUS 1024
+
+/* Storage of the Package 1 globals. They are plain globals in the benchmark
+ * used by the fork mode, so that its code (and score) is unaffected by the
+ * pthread mode, which uses the thread-local copy compiled at the end of the
+ * file. */
+#define THREAD_LOCAL
+
 /* Dhrystones per second obtained on VAX11/780 -- a notional 1MIPS machine. */
 /* Used in DMIPS calculation. */
 #define ONE_MIPS 1757
@@ -481,6 +495,7 @@ typedef int		boolean;
 extern Enumeration	Func1();
 extern boolean		Func2();
 
+#define _GNU_SOURCE
 #ifdef TIMES
 #include <sys/param.h>
 #include <sys/types.h>
@@ -495,6 +510,22 @@ extern boolean		Func2();
 #include <stdio.h>
 #include <string.h>
 #include <sys/time.h>
+#include <pthread.h>
+#include <sched.h>
+
+struct dhrystone_thread {
+	pthread_t thread;
+	int index;
+	int cpu;		/* -1 if the thread is not pinned */
+	int duration;
+	long num_loops;
+	long passes;
+	double wall_time;
+};
+
+double get_wall_time(void);
+long run_for_duration(int duration, long num_loops, boolean print_result,
+		      boolean thread_local);
 
 
 main(int argc, char** argv)
@@ -503,9 +534,13 @@ main(int argc, char** argv)
 	int runtime = 0;
 	int delay = 0;
 	long mloops = 0;
+	int use_pthreads = 0;
+	int cpus[MAX_PIN_CPUS];
+	int num_cpus = 0;
+	char *cpu;
 
 	int opt;
-	while ((opt = getopt(argc, argv, "ht:r:d:l:")) != -1) {
+	while ((opt = getopt(argc, argv, "ht:r:d:l:pc:")) != -1) {
 		switch (opt) {
 			case 'h':
 				printhelp();
@@ -523,6 +558,23 @@ main(int argc, char** argv)
 			case 'l':
 				mloops = atoll(optarg);
 				break;
+			case 'p':
+				use_pthreads = 1;
+				break;
+			case 'c':
+				for (cpu = strtok(optarg, ","); cpu; cpu = strtok(NULL, ",")) {
+					if (num_cpus == MAX_PIN_CPUS) {
+						fprintf(stderr, "Too many CPUs specified with -c.\n");
+						exit(1);
+					}
+					cpus[num_cpus] = atoi(cpu);
+					if (cpus[num_cpus] < 0 || cpus[num_cpus] >= CPU_SETSIZE) {
+						fprintf(stderr, "Invalid CPU %s.\n", cpu);
+						exit(1);
+					}
+					num_cpus++;
+				}
+				break;
 		}
 	}
 
@@ -535,20 +587,56 @@ main(int argc, char** argv)
 	}
 
 	long num_loops = mloops ? mloops * 1000000L : LOOPS * num_threads;
-	run_dhrystone(runtime, num_threads, num_loops, delay);
+	if (use_pthreads)
+		run_dhrystone_threads(runtime, num_threads, num_loops, delay, cpus, num_cpus);
+	else
+		run_dhrystone(runtime, num_threads, num_loops, delay, cpus, num_cpus);
+}
+
+double get_wall_time(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Pin the calling thread to the CPU of the i'th thread in the pinning map,
+ * returning that CPU, or -1 if there is no map. */
+int pin_thread(int i, int *cpus, int num_cpus) {
+	cpu_set_t mask;
+	int cpu;
+
+	if (!num_cpus)
+		return -1;
+
+	cpu = cpus[i % num_cpus];
+	CPU_ZERO(&mask);
+	CPU_SET(cpu, &mask);
+	if (sched_setaffinity(0, sizeof(mask), &mask)) {
+		fprintf(stderr, "Could not pin thread %d to CPU %d.\n", i, cpu);
+		exit(1);
+	}
+	return cpu;
 }
 
-run_dhrystone(int duration, int num_threads, long num_loops, int delay) {
+void print_header(int duration, int num_threads, long num_loops, int delay) {
 	printf("duration: %d seconds\n", duration);
 	printf("number of threads: %d\n", num_threads);
 	printf("number of loops: %ld\n", num_loops);
 	printf("delay between starting threads: %d seconds\n", delay);
 	printf("\n");
+	/* Don't let forked children inherit the buffered output. */
+	fflush(stdout);
+}
+
+run_dhrystone(int duration, int num_threads, long num_loops, int delay,
+	      int *cpus, int num_cpus) {
+	print_header(duration, num_threads, num_loops, delay);
 
 	pid_t *children = malloc(num_threads* sizeof(pid_t));
 	int loops_per_thread = num_loops / num_threads;
 
-	clock_t run_start = clock();
+	double run_start = get_wall_time();
 
 	long i;
 	int actual_duration;
@@ -556,10 +644,11 @@ run_dhrystone(int duration, int num_threads, long num_loops, int delay) {
 		pid_t c = fork();
 		if (c == 0) {
 			// child
+			pin_thread(i, cpus, num_cpus);
 			actual_duration = duration - i * delay;
 			if (actual_duration < 0)
 				actual_duration = 0;
-			run_for_duration(actual_duration, loops_per_thread);
+			run_for_duration(actual_duration, loops_per_thread, actual_duration == 0, FALSE);
 			exit(0);
 		}
 		
@@ -570,7 +659,8 @@ run_dhrystone(int duration, int num_threads, long num_loops, int delay) {
 	actual_duration = duration - delay * (num_threads - 1);
 	if (actual_duration < 0)
 		actual_duration = 0;
-	run_for_duration(actual_duration, loops_per_thread);
+	pin_thread(num_threads - 1, cpus, num_cpus);
+	run_for_duration(actual_duration, loops_per_thread, actual_duration == 0, FALSE);
 
 	for (i = 0; i < num_threads; i++) {
 		int status, w;
@@ -579,22 +669,107 @@ run_dhrystone(int duration, int num_threads, long num_loops, int delay) {
 		} while (w != -1 && (!WIFEXITED(status) && !WIFSIGNALED(status)));
 	}
 
-	clock_t run_end = clock();
-	printf("\nTotal dhrystone run time: %f seconds.\n", (double)(run_end - run_start) / CLOCKS_PER_SEC);
+	double run_end = get_wall_time();
+	printf("\nTotal dhrystone run time: %f seconds.\n", run_end - run_start);
 
 	exit(0);
 }
 
-run_for_duration(int duration, long num_loops) {
-	clock_t end = clock() + duration * CLOCKS_PER_SEC;
+/* Returns the number of passes that have been run. */
+long run_for_duration(int duration, long num_loops, boolean print_result,
+		      boolean thread_local) {
+	double end = get_wall_time() + duration;
+	long passes = 0;
 
 	do {
-		Proc0(num_loops, duration == 0);
-	} while (clock() < end);
+		if (thread_local)
+			Proc0_tls(num_loops, print_result);
+		else
+			Proc0(num_loops, print_result);
+		passes += num_loops;
+	} while (get_wall_time() < end);
+	return passes;
+}
+
+void *dhrystone_thread_main(void *arg) {
+	struct dhrystone_thread *t = arg;
+	double start = get_wall_time();
+
+	t->passes = run_for_duration(t->duration, t->num_loops, FALSE, TRUE);
+	t->wall_time = get_wall_time() - start;
+	return NULL;
+}
+
+/* Like run_dhrystone(), but runs the benchmark in threads of this process
+ * rather than in forked processes, and reports the rate of each thread based
+ * on its wall clock time (rather than process CPU time, which would include
+ * all the threads). */
+run_dhrystone_threads(int duration, int num_threads, long num_loops, int delay,
+		      int *cpus, int num_cpus) {
+	struct dhrystone_thread *threads;
+	pthread_attr_t attr;
+	cpu_set_t mask;
+	int i;
+
+	print_header(duration, num_threads, num_loops, delay);
+
+	threads = calloc(num_threads, sizeof(*threads));
+	if (!threads) {
+		fprintf(stderr, "Could not allocate threads.\n");
+		exit(1);
+	}
+
+	double run_start = get_wall_time();
+	for (i = 0; i < num_threads; i++) {
+		struct dhrystone_thread *t = &threads[i];
+
+		t->index = i;
+		t->cpu = num_cpus ? cpus[i % num_cpus] : -1;
+		t->num_loops = num_loops / num_threads;
+		t->duration = duration - i * delay;
+		if (t->duration < 0)
+			t->duration = 0;
+
+		/* Threads start on their CPU rather than migrating there. */
+		pthread_attr_init(&attr);
+		if (t->cpu >= 0) {
+			CPU_ZERO(&mask);
+			CPU_SET(t->cpu, &mask);
+			pthread_attr_setaffinity_np(&attr, sizeof(mask), &mask);
+		}
+		if (pthread_create(&t->thread, &attr, dhrystone_thread_main, t)) {
+			fprintf(stderr, "Could not create thread %d.\n", i);
+			exit(1);
+		}
+		pthread_attr_destroy(&attr);
+
+		if (i < num_threads - 1)
+			sleep(delay);
+	}
+
+	for (i = 0; i < num_threads; i++)
+		pthread_join(threads[i].thread, NULL);
+	double run_end = get_wall_time();
+
+	for (i = 0; i < num_threads; i++) {
+		struct dhrystone_thread *t = &threads[i];
+
+		printf("Thread %d (CPU %d): Dhrystone(%s) wall time for %ld passes = %.3f\n",
+		       t->index, t->cpu, Version, t->passes, t->wall_time);
+		printf("This machine benchmarks at %.0f dhrystones/second\n",
+		       (double)t->passes / t->wall_time);
+		printf("                           %.0f DMIPS\n",
+		       (double)t->passes / t->wall_time / ONE_MIPS);
+	}
+
+	printf("\nTotal dhrystone run time: %f seconds.\n", run_end - run_start);
+
+	free(threads);
+	exit(0);
 }
 
 printhelp() {
-	printf("Usage: dhrystone (-h | -l MLOOPS | -r DURATION) [-t THREADS [-d DELAY]]\n");
+	printf("Usage: dhrystone (-h | -l MLOOPS | -r DURATION) [-t THREADS [-d DELAY]] [-p] [-c CPUS]\n");
 	printf("\n");
 	printf("Runs dhrystone benchmark either for a specfied duration or for a specified\n");
 	printf("number of iterations.\n");
@@ -614,21 +789,27 @@ printhelp() {
 	printf("                actually) that will be spawned. Defaults to 1.\n");
 	printf("    -d DELAY    if THREADS is > 1, this specifies the delay between\n");
 	printf("                spawning the threads.\n");
+	printf("    -p          Run the threads as pthreads of a single process rather\n");
+	printf("                than as forked processes, and report the wall clock\n");
+	printf("                time and rate of each thread.\n");
+	printf("    -c CPUS     Comma-separated list of CPUs to pin the threads to; the\n");
+	printf("                i'th thread is pinned to the (i %% N)'th of the N CPUs.\n");
 	printf("\n");
 }
 
+#endif /* DHRY_TLS_BODY */
 
 /*
  * Package 1
  */
-int		IntGlob;
-boolean		BoolGlob;
-char		Char1Glob;
-char		Char2Glob;
-Array1Dim	Array1Glob;
-Array2Dim	Array2Glob;
-RecordPtr	PtrGlb;
-RecordPtr	PtrGlbNext;
+THREAD_LOCAL int		IntGlob;
+THREAD_LOCAL boolean		BoolGlob;
+THREAD_LOCAL char		Char1Glob;
+THREAD_LOCAL char		Char2Glob;
+THREAD_LOCAL Array1Dim	Array1Glob;
+THREAD_LOCAL Array2Dim	Array2Glob;
+THREAD_LOCAL RecordPtr	PtrGlb;
+THREAD_LOCAL RecordPtr	PtrGlbNext;
 
 Proc0(long numloops, boolean print_result)
 {
@@ -951,6 +1132,8 @@ REG Enumeration	EnumParIn;
 	return (FALSE);
 }
 
+#ifndef DHRY_TLS_BODY
+
 #ifdef	NOSTRUCTASSIGN
 memcpy(d, s, l)
 register char	*d;
@@ -961,3 +1144,37 @@ register int	l;
 }
 #endif
 /* ---------- */
+
+/*
+ * Package 1 again, for the pthread mode: the globals are thread-local so that
+ * each thread runs the benchmark on its own state, and all the names get a
+ * _tls suffix.
+ */
+#define DHRY_TLS_BODY
+#undef THREAD_LOCAL
+#define THREAD_LOCAL __thread
+#define IntGlob	IntGlob_tls
+#define BoolGlob	BoolGlob_tls
+#define Char1Glob	Char1Glob_tls
+#define Char2Glob	Char2Glob_tls
+#define Array1Glob	Array1Glob_tls
+#define Array2Glob	Array2Glob_tls
+#define PtrGlb	PtrGlb_tls
+#define PtrGlbNext	PtrGlbNext_tls
+#define Proc0	Proc0_tls
+#define Proc1	Proc1_tls
+#define Proc2	Proc2_tls
+#define Proc3	Proc3_tls
+#define Proc4	Proc4_tls
+#define Proc5	Proc5_tls
+#define Proc6	Proc6_tls
+#define Proc7	Proc7_tls
+#define Proc8	Proc8_tls
+#define Func1	Func1_tls
+#define Func2	Func2_tls
+#define Func3	Func3_tls
+extern Enumeration	Func1();
+extern boolean		Func2();
+#include "dhrystone.c"
+
+#endif /* DHRY_TLS_BODY */
@@ -18,15 +18,19 @@
 import os
 import re
 
-from wa import Workload, Parameter, Executable
+from wa import Workload, Parameter, Executable, TargetError, WorkloadError
 from wa.utils.exec_control import once
-from wa.utils.types import cpu_mask
+from wa.utils.types import cpu_mask, caseless_string
 
 
 THIS_DIR = os.path.dirname(__file__)
 
 
 RESULT_REGEX = re.compile('Total time: ([\d.]+) s.*Bandwidth: ([\d.]+) MB/s', re.S)
+THREAD_RESULT_REGEX = re.compile(r'Thread (\d+) \(CPU (\d+)\) (time|bandwidth): ([\d.]+)')
+LATENCY_REGEX = re.compile(r'(?:Thread (\d+) \(CPU (\d+)\) i|I)teration latency '
+                           r'min/median/p99/max: ([\d.]+)/([\d.]+)/([\d.]+)/([\d.]+) us')
+LATENCY_STATS = ['min', 'median', 'p99', 'max']
 
 
 class Memcpy(Workload):
@@ -39,8 +43,26 @@ class Memcpy(Workload):
     of a specified size. Additionally, the affinity of the test can be set to
     one or more specific cores.
 
-    This workload is single-threaded. It generates no scores or metrics by
-    itself.
+    By default, this workload is single-threaded. If ``threaded`` is set, one
+    copy thread is pinned to each of the specified cores (or each available
+    core), and all of them run at the same time. The bandwidth of each thread
+    is then reported in addition to the aggregate, which can be used to find
+    the point at which memory bandwidth saturates within a cluster or across
+    the SoC.
+
+    Instead of a single buffer size, a range of sizes may be swept over with
+    ``sweep``, in which case a bandwidth metric is reported for each size,
+    e.g. to find where the bandwidth falls off at each level of the cache
+    hierarchy. The per-size results are also saved as ``memcpy.csv``.
+
+    Warmup iterations may be run before timing starts, so that page faults and
+    frequency ramp-up are excluded, and the distribution of per-iteration
+    times may be reported. With ``trace_markers``, the start of each phase is
+    written to ftrace's trace_marker so that runs can be lined up with e.g.
+    frequency changes in a trace.
+
+    The parameters other than ``buffer_size``, ``loops`` and ``cpus`` need a
+    memcpy binary built from the current sources (see ``src/build.sh``).
 
     """
 
@@ -60,6 +82,56 @@ class Memcpy(Workload):
                   cpus or a sysfs-style string. If not specified, all available
                   cores will be used.
                   '''),
+        Parameter('threaded', kind=bool, default=False,
+                  description='''
+                  Run a separate copy thread, each with its own buffers, on
+                  each of the ``cpus`` concurrently, rather than a single
+                  copy thread whose affinity is set to all of them.
+                  '''),
+        Parameter('kernel', kind=caseless_string, default='memcpy',
+                  allowed_values=['memcpy', 'memset', 'read', 'simd', 'nt'],
+                  description='''
+                  The operation that is timed: libc ``memcpy``, libc
+                  ``memset`` of the destination, a ``read``-only reduction over
+                  the source, a ``simd`` copy using NEON (or SSE2) loads and
+                  stores, or an ``nt`` copy using non-temporal stores.
+                  Binaries built without the instructions they need (e.g.
+                  armeabi without NEON) reject ``simd`` and ``nt``.
+                  '''),
+        Parameter('sweep', kind=str, default=None,
+                  description='''
+                  A range of buffer sizes, as ``MIN:MAX`` (e.g. ``4K:256M``),
+                  to run the kernel over. The size is doubled at each step,
+                  and the number of iterations scaled such that each step
+                  processes ``buffer_size * loops`` bytes.
+                  '''),
+        Parameter('huge_pages', kind=bool, default=False,
+                  description='''
+                  Request transparent huge pages for the buffers.
+                  '''),
+        Parameter('prefault', kind=bool, default=False,
+                  description='''
+                  Write to the buffers before timing starts, so that page
+                  faults are not included in the measurement. (Buffers are
+                  always prefaulted when ``threaded`` is set or ``kernel`` is
+                  ``read``.)
+                  '''),
+        Parameter('warmup', kind=int, default=0,
+                  description='''
+                  The number of untimed iterations to run before the timed
+                  ones.
+                  '''),
+        Parameter('iteration_latency', kind=bool, default=False,
+                  description='''
+                  Time each iteration individually and report the minimum,
+                  median, 99th percentile and maximum iteration times.
+                  '''),
+        Parameter('trace_markers', kind=bool, default=False,
+                  description='''
+                  Write a marker to ftrace's trace_marker at the start of the
+                  warmup, at the start of the timed iterations, and at their
+                  end (for each thread).
+                  '''),
     ]
 
     @once
@@ -68,21 +140,103 @@ class Memcpy(Workload):
         resource = Executable(self, self.target.abi, self.binary_name)
         host_binary = context.get_resource(resource)
         Memcpy.target_exe = self.target.install_if_needed(host_binary)
+        # Older builds of the binary only accept -i, -c and -s, and abort on
+        # any other option.
+        try:
+            self.target.execute('{} -k memcpy -i 1 -s 4096'.format(Memcpy.target_exe))
+            Memcpy.extended_options = True
+        except TargetError:
+            Memcpy.extended_options = False
 
     def setup(self, context):
         self.command = '{} -i {} -s {}'.format(Memcpy.target_exe, self.loops, self.buffer_size)
         for c in self.cpus.list():
             self.command += ' -c {}'.format(c)
+        extended = []
+        if self.threaded:
+            self.command += ' -t'
+            extended.append('threaded')
+        if self.kernel != 'memcpy':
+            self.command += ' -k {}'.format(self.kernel)
+            extended.append('kernel')
+        if self.sweep:
+            self.command += ' -w {} -m'.format(self.sweep)
+            extended.append('sweep')
+        if self.huge_pages:
+            self.command += ' -H'
+            extended.append('huge_pages')
+        if self.prefault:
+            self.command += ' -p'
+            extended.append('prefault')
+        if self.warmup:
+            self.command += ' -W {}'.format(self.warmup)
+            extended.append('warmup')
+        if self.iteration_latency:
+            self.command += ' -l'
+            extended.append('iteration_latency')
+        if self.trace_markers:
+            self.command += ' -T'
+            extended.append('trace_markers')
+        if extended and not Memcpy.extended_options:
+            msg = 'The memcpy binary on the target does not support {}; ' \
+                  'rebuild it with src/build.sh'
+            raise WorkloadError(msg.format(', '.join(extended)))
         self.result = None
 
     def run(self, context):
         self.result = self.target.execute(self.command, timeout=300)
 
     def extract_results(self, context):
-        if self.result:
+        if self.result and self.sweep:
+            self._extract_sweep_results(context)
+        elif self.result:
             match = RESULT_REGEX.search(self.result)
             context.add_metric('time', float(match.group(1)), 'seconds', lower_is_better=True)
             context.add_metric('bandwidth', float(match.group(2)), 'MB/s')
+            for thread, cpu, kind, value in THREAD_RESULT_REGEX.findall(self.result):
+                classifiers = {'thread': int(thread), 'cpu': int(cpu)}
+                if kind == 'time':
+                    context.add_metric('thread_time', float(value), 'seconds',
+                                       lower_is_better=True, classifiers=classifiers)
+                else:
+                    context.add_metric('thread_bandwidth', float(value), 'MB/s',
+                                       classifiers=classifiers)
+            for match in LATENCY_REGEX.finditer(self.result):
+                thread, cpu = match.group(1), match.group(2)
+                classifiers = {}
+                if thread is not None:
+                    classifiers = {'thread': int(thread), 'cpu': int(cpu)}
+                for stat, value in zip(LATENCY_STATS, match.groups()[2:]):
+                    context.add_metric('iteration_latency_{}'.format(stat), float(value),
+                                       'microseconds', lower_is_better=True,
+                                       classifiers=classifiers)
+
+    def _extract_sweep_results(self, context):
+        outfile = os.path.join(context.output_directory, 'memcpy.csv')
+        with open(outfile, 'w') as wfh:
+            wfh.write(self.result)
+        context.add_artifact('memcpy-sweep', outfile, 'data',
+                             'Bandwidth for each buffer size in the sweep')
+
+        lines = self.result.strip().splitlines()
+        header = lines[0].split(',')
+        for line in lines[1:]:
+            row = dict(zip(header, line.split(',')))
+            classifiers = {'kernel': row['kernel'], 'size': int(row['size'])}
+            if row['thread'] == 'total':
+                name = 'bandwidth'
+            else:
+                name = 'thread_bandwidth'
+                classifiers['thread'] = int(row['thread'])
+                classifiers['cpu'] = int(row['cpu'])
+            context.add_metric(name, float(row['bandwidth']), 'MB/s',
+                               classifiers=classifiers)
+            for stat in LATENCY_STATS:
+                value = row.get('latency_{}'.format(stat))
+                if value:
+                    context.add_metric('iteration_latency_{}'.format(stat), float(value),
+                                       'microseconds', lower_is_better=True,
+                                       classifiers=classifiers)
 
     @once
     def finalize(self, context):
@@ -13,4 +13,4 @@
 # limitations under the License.
 #
 
-${CROSS_COMPILE}gcc -static memcopy.c -o memcopy
+${CROSS_COMPILE}gcc -static -pthread memcopy.c -o memcopy
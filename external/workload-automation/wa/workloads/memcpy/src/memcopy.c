@@ -17,98 +17,736 @@
 #define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <sched.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/syscall.h>
 #include <pthread.h>
 #include <time.h>
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// The simd and nt kernels are only available where they are implemented with
+// the corresponding instructions, rather than silently falling back to
+// memcpy(). (e.g. 32-bit ARM builds without -mfpu=neon have neither.)
+#if defined(__ARM_NEON) || defined(__SSE2__)
+#define HAVE_SIMD_KERNEL 1
+#else
+#define HAVE_SIMD_KERNEL 0
+#endif
+#if defined(__aarch64__) || defined(__SSE2__)
+#define HAVE_NT_KERNEL 1
+#else
+#define HAVE_NT_KERNEL 0
+#endif
 
-const int MAX_CPUS = 8;
 const int DEFAULT_ITERATIONS = 1000;
 const int DEFAULT_BUFFER_SIZE = 1024 * 1024 * 5;
 
+// Granularity of the SIMD and non-temporal kernels; any remainder of the
+// buffer is handled with memcpy().
+#define KERNEL_BLOCK_SIZE 64
+
+enum kernel
+{
+	KERNEL_MEMCPY = 0,
+	KERNEL_MEMSET,
+	KERNEL_READ,
+	KERNEL_SIMD,
+	KERNEL_NT,
+	KERNEL_INVALID
+};
+
+const char *kernel_names[] = { "memcpy", "memset", "read", "simd", "nt" };
+
+struct options
+{
+	enum kernel kernel;
+	int huge_pages;
+	int prefault;
+	int csv;
+	int warmup;
+	int latency;
+	int trace;
+};
+
+struct latency_stats
+{
+	double min, median, p99, max;
+};
+
+struct copy_thread
+{
+	pthread_t thread;
+	int cpu;
+	int iterations;
+	size_t buffer_size;
+	const struct options *opts;
+	pthread_barrier_t *barrier;
+	struct timespec before, after;
+	uint64_t *latencies;
+	int error;
+};
+
+// Keeps the result of the read kernel live.
+volatile uint64_t read_sink;
+
+const char *trace_marker_paths[] = {
+	"/sys/kernel/debug/tracing/trace_marker",
+	"/sys/kernel/tracing/trace_marker",
+};
+
+int trace_marker_fd = -1;
+
+int open_trace_marker(void)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(trace_marker_paths) / sizeof(trace_marker_paths[0]); ++i)
+	{
+		trace_marker_fd = open(trace_marker_paths[i], O_WRONLY);
+		if (trace_marker_fd >= 0)
+			return 0;
+	}
+	return -errno;
+}
+
+// Mark the start of each phase of a run, so that it may be lined up with
+// e.g. frequency changes in a trace.
+void write_trace_marker(const struct options *opts, const char *phase, size_t size,
+			int iterations, int cpu)
+{
+	char marker[128];
+	int len;
+
+	if (!opts->trace)
+		return;
+
+	len = snprintf(marker, sizeof(marker), "MEMCPY_%s kernel=%s size=%zu iterations=%i cpu=%i\n",
+		       phase, kernel_names[opts->kernel], size, iterations, cpu);
+	if (write(trace_marker_fd, marker, len) < 0)
+		fprintf(stderr, "Could not write trace marker: %s\n", strerror(errno));
+}
+
+uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+// Sorts the latencies in place.
+void get_latency_stats(uint64_t *latencies, int count, struct latency_stats *stats)
+{
+	qsort(latencies, count, sizeof(uint64_t), compare_u64);
+	stats->min = latencies[0] / 1e3;
+	stats->median = latencies[count / 2] / 1e3;
+	stats->p99 = latencies[(int)(count * 0.99)] / 1e3;
+	stats->max = latencies[count - 1] / 1e3;
+}
+
+double timespec_delta(const struct timespec *before, const struct timespec *after)
+{
+	long delta_sec =  (long)(after->tv_sec - before->tv_sec);
+	long delta_nsec = after->tv_nsec - before->tv_nsec;
+	return (double)delta_sec + delta_nsec / 1e9;
+}
+
 int set_affinity(size_t cpus_size, int* cpus)
 {
-	int i;
-	int mask = 0;
+	size_t i;
+	cpu_set_t mask;
 
+	CPU_ZERO(&mask);
 	for(i = 0; i < cpus_size; ++i)
 	{
-		mask |= 1 << cpus[i];
+		CPU_SET(cpus[i], &mask);
+	}
+
+	return sched_setaffinity(0, sizeof(mask), &mask);
+}
+
+// Parse a size in bytes, with an optional K, M or G suffix.
+size_t parse_size(const char *str)
+{
+	char *end;
+	size_t size = strtoul(str, &end, 10);
+
+	switch (*end)
+	{
+	case 'k':
+	case 'K':
+		size <<= 10;
+		break;
+	case 'm':
+	case 'M':
+		size <<= 20;
+		break;
+	case 'g':
+	case 'G':
+		size <<= 30;
+		break;
+	case '\0':
+		break;
+	default:
+		fprintf(stderr, "Invalid size %s.", str);
+		abort();
+	}
+	return size;
+}
+
+enum kernel parse_kernel(const char *str)
+{
+	int i;
+
+	for (i = 0; i < KERNEL_INVALID; ++i)
+		if (!strcmp(str, kernel_names[i]))
+			break;
+
+	if (i == KERNEL_INVALID)
+	{
+		fprintf(stderr, "Invalid kernel %s.", str);
+		abort();
+	}
+	if ((i == KERNEL_SIMD && !HAVE_SIMD_KERNEL) || (i == KERNEL_NT && !HAVE_NT_KERNEL))
+	{
+		fprintf(stderr, "Kernel %s is not supported by this build.", str);
+		abort();
+	}
+	return i;
+}
+
+void* alloc_buffer(size_t size, const struct options *opts)
+{
+	char *buffer = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buffer == MAP_FAILED)
+		return NULL;
+
+#ifdef MADV_HUGEPAGE
+	if (opts->huge_pages)
+		madvise(buffer, size, MADV_HUGEPAGE);
+#endif
+	// Otherwise the first iteration pays for the page faults.
+	if (opts->prefault)
+		memset(buffer, 0x5a, size);
+
+	return buffer;
+}
+
+void free_buffer(void *buffer, size_t size)
+{
+	if (buffer)
+		munmap(buffer, size);
+}
+
+uint64_t read_buffer(const char *source, size_t size)
+{
+	const uint64_t *p = (const uint64_t *)source;
+	const uint64_t *end = p + size / sizeof(uint64_t);
+	uint64_t a = 0, b = 0, c = 0, d = 0;
+
+	for (; p + 4 <= end; p += 4)
+	{
+		a += p[0];
+		b += p[1];
+		c += p[2];
+		d += p[3];
+	}
+	for (; p < end; ++p)
+		a += *p;
+	return a + b + c + d;
+}
+
+void simd_copy(char *dest, const char *source, size_t size)
+{
+	size_t i, blocks = size - size % KERNEL_BLOCK_SIZE;
+
+	for (i = 0; i < blocks; i += KERNEL_BLOCK_SIZE)
+	{
+#if defined(__ARM_NEON)
+		uint8x16_t a = vld1q_u8((const uint8_t *)source + i);
+		uint8x16_t b = vld1q_u8((const uint8_t *)source + i + 16);
+		uint8x16_t c = vld1q_u8((const uint8_t *)source + i + 32);
+		uint8x16_t d = vld1q_u8((const uint8_t *)source + i + 48);
+		vst1q_u8((uint8_t *)dest + i, a);
+		vst1q_u8((uint8_t *)dest + i + 16, b);
+		vst1q_u8((uint8_t *)dest + i + 32, c);
+		vst1q_u8((uint8_t *)dest + i + 48, d);
+#elif defined(__SSE2__)
+		__m128i a = _mm_loadu_si128((const __m128i *)(source + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(source + i + 16));
+		__m128i c = _mm_loadu_si128((const __m128i *)(source + i + 32));
+		__m128i d = _mm_loadu_si128((const __m128i *)(source + i + 48));
+		_mm_storeu_si128((__m128i *)(dest + i), a);
+		_mm_storeu_si128((__m128i *)(dest + i + 16), b);
+		_mm_storeu_si128((__m128i *)(dest + i + 32), c);
+		_mm_storeu_si128((__m128i *)(dest + i + 48), d);
+#else
+		memcpy(dest + i, source + i, KERNEL_BLOCK_SIZE);
+#endif
+	}
+	memcpy(dest + blocks, source + blocks, size - blocks);
+}
+
+// Copy using stores that hint the data should not be allocated in the caches.
+void nt_copy(char *dest, const char *source, size_t size)
+{
+	size_t i, blocks = size - size % KERNEL_BLOCK_SIZE;
+
+	for (i = 0; i < blocks; i += KERNEL_BLOCK_SIZE)
+	{
+#if defined(__aarch64__)
+		asm volatile(
+			"ldp q0, q1, [%1]\n"
+			"ldp q2, q3, [%1, #32]\n"
+			"stnp q0, q1, [%0]\n"
+			"stnp q2, q3, [%0, #32]\n"
+			: : "r" (dest + i), "r" (source + i)
+			: "v0", "v1", "v2", "v3", "memory");
+#elif defined(__SSE2__)
+		// Buffers are page-aligned, so blocks are 16-byte aligned.
+		__m128i a = _mm_load_si128((const __m128i *)(source + i));
+		__m128i b = _mm_load_si128((const __m128i *)(source + i + 16));
+		__m128i c = _mm_load_si128((const __m128i *)(source + i + 32));
+		__m128i d = _mm_load_si128((const __m128i *)(source + i + 48));
+		_mm_stream_si128((__m128i *)(dest + i), a);
+		_mm_stream_si128((__m128i *)(dest + i + 16), b);
+		_mm_stream_si128((__m128i *)(dest + i + 32), c);
+		_mm_stream_si128((__m128i *)(dest + i + 48), d);
+#else
+		memcpy(dest + i, source + i, KERNEL_BLOCK_SIZE);
+#endif
+	}
+#if defined(__SSE2__) && !defined(__aarch64__)
+	_mm_sfence();
+#endif
+	memcpy(dest + blocks, source + blocks, size - blocks);
+}
+
+// If latencies is not NULL, the duration of each iteration is stored in it, in nS.
+void run_kernel(enum kernel kernel, char *dest, const char *source, size_t size, int iterations,
+		uint64_t *latencies)
+{
+	uint64_t sum = 0, before = 0, after;
+	int i;
+
+	if (latencies)
+		before = get_time_ns();
+	for (i = 0; i < iterations; ++i)
+	{
+		switch (kernel)
+		{
+		case KERNEL_MEMCPY:
+			memcpy(dest, source, size);
+			break;
+		case KERNEL_MEMSET:
+			memset(dest, i, size);
+			break;
+		case KERNEL_READ:
+			sum += read_buffer(source, size);
+			break;
+		case KERNEL_SIMD:
+			simd_copy(dest, source, size);
+			break;
+		case KERNEL_NT:
+			nt_copy(dest, source, size);
+			break;
+		default:
+			break;
+		}
+		if (latencies)
+		{
+			after = get_time_ns();
+			latencies[i] = after - before;
+			before = after;
+		}
+	}
+	read_sink = sum;
+}
+
+void print_result(const struct options *opts, const char *thread, int cpu,
+		  size_t size, int iterations, double delta, double bandwidth,
+		  const struct latency_stats *stats)
+{
+	if (opts->csv)
+	{
+		printf("%s,%zu,%i,%s,", kernel_names[opts->kernel], size, iterations, thread);
+		if (cpu >= 0)
+			printf("%i", cpu);
+		printf(",%f,%f", delta, bandwidth);
+		if (stats)
+			printf(",%.3f,%.3f,%.3f,%.3f\n", stats->min, stats->median, stats->p99, stats->max);
+		else
+			printf(",,,,\n");
+	}
+	else if (cpu >= 0)
+	{
+		printf("Thread %s (CPU %i) time: %f s\n", thread, cpu, delta);
+		printf("Thread %s (CPU %i) bandwidth: %f MB/s\n", thread, cpu, bandwidth);
+		if (stats)
+			printf("Thread %s (CPU %i) iteration latency min/median/p99/max: %.3f/%.3f/%.3f/%.3f us\n",
+			       thread, cpu, stats->min, stats->median, stats->p99, stats->max);
+	}
+	else
+	{
+		printf("Total time: %f s\n", delta);
+		printf("Bandwidth: %f MB/s\n", bandwidth);
+		if (stats)
+			printf("Iteration latency min/median/p99/max: %.3f/%.3f/%.3f/%.3f us\n",
+			       stats->min, stats->median, stats->p99, stats->max);
+	}
+}
+
+void* copy_thread_main(void *arg)
+{
+	struct copy_thread *ct = arg;
+	struct options opts = *ct->opts;
+
+	if (set_affinity(1, &ct->cpu))
+	{
+		ct->error = 1;
+	}
+
+	// Touch the buffers from the thread that uses them, so that they
+	// are backed by memory local to its CPU.
+	opts.prefault = 1;
+	char* source  = alloc_buffer(ct->buffer_size, &opts);
+	char* dest = alloc_buffer(ct->buffer_size, &opts);
+	if (opts.latency)
+		ct->latencies = malloc(sizeof(uint64_t) * ct->iterations);
+	if (!source || !dest || (opts.latency && !ct->latencies))
+	{
+		ct->error = 1;
+	}
+
+	if (!ct->error && opts.warmup)
+	{
+		write_trace_marker(&opts, "WARMUP", ct->buffer_size, opts.warmup, ct->cpu);
+		run_kernel(opts.kernel, dest, source, ct->buffer_size, opts.warmup, NULL);
+	}
+
+	pthread_barrier_wait(ct->barrier);
+	write_trace_marker(&opts, "START", ct->buffer_size, ct->iterations, ct->cpu);
+	clock_gettime(CLOCK_MONOTONIC, &ct->before);
+	if (!ct->error)
+	{
+		run_kernel(opts.kernel, dest, source, ct->buffer_size, ct->iterations, ct->latencies);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ct->after);
+	write_trace_marker(&opts, "END", ct->buffer_size, ct->iterations, ct->cpu);
+
+	free_buffer(dest, ct->buffer_size);
+	free_buffer(source, ct->buffer_size);
+	return NULL;
+}
+
+// Run one copy thread pinned to each of the specified CPUs, all at the same
+// time, and report the bandwidth of each as well as the aggregate.
+int run_threads(size_t cpus_size, int *cpus, int iterations, size_t buffer_size,
+		const struct options *opts)
+{
+	struct copy_thread *threads;
+	pthread_barrier_t barrier;
+	struct timespec before, after;
+	char thread_name[24];
+	size_t i;
+
+	threads = calloc(cpus_size, sizeof(*threads));
+	if (!threads)
+	{
+		fprintf(stderr, "Could not allocate threads.");
+		abort();
+	}
+	pthread_barrier_init(&barrier, NULL, cpus_size);
+
+	for (i = 0; i < cpus_size; ++i)
+	{
+		threads[i].cpu = cpus[i];
+		threads[i].iterations = iterations;
+		threads[i].buffer_size = buffer_size;
+		threads[i].opts = opts;
+		threads[i].barrier = &barrier;
+		if (pthread_create(&threads[i].thread, NULL, copy_thread_main, &threads[i]))
+		{
+			fprintf(stderr, "Could not create thread for CPU %i.", cpus[i]);
+			abort();
+		}
+	}
+
+	for (i = 0; i < cpus_size; ++i)
+	{
+		pthread_join(threads[i].thread, NULL);
+		if (threads[i].error)
+		{
+			fprintf(stderr, "Could not set up thread for CPU %i.", cpus[i]);
+			abort();
+		}
+	}
+
+	// The aggregate covers the span from the first thread starting to the
+	// last one finishing.
+	before = threads[0].before;
+	after = threads[0].after;
+	for (i = 0; i < cpus_size; ++i)
+	{
+		double delta = timespec_delta(&threads[i].before, &threads[i].after);
+		struct latency_stats stats;
+		if (threads[i].latencies)
+			get_latency_stats(threads[i].latencies, iterations, &stats);
+		snprintf(thread_name, sizeof(thread_name), "%zu", i);
+		print_result(opts, thread_name, threads[i].cpu, buffer_size, iterations,
+			     delta, buffer_size / delta * iterations / 1e6,
+			     threads[i].latencies ? &stats : NULL);
+		free(threads[i].latencies);
+		if (timespec_delta(&threads[i].before, &before) > 0)
+			before = threads[i].before;
+		if (timespec_delta(&after, &threads[i].after) > 0)
+			after = threads[i].after;
 	}
-	
-	return syscall(__NR_sched_setaffinity, 0, sizeof(mask), &mask);
+
+	double delta = timespec_delta(&before, &after);
+	print_result(opts, "total", -1, buffer_size, iterations, delta,
+		     buffer_size / delta * iterations / 1e6 * cpus_size, NULL);
+
+	pthread_barrier_destroy(&barrier);
+	free(threads);
+	return 0;
+}
+
+int run_single(int iterations, size_t buffer_size, const struct options *opts)
+{
+	char* source  = alloc_buffer(buffer_size, opts);
+	char* dest = alloc_buffer(buffer_size, opts);
+	uint64_t *latencies = NULL;
+	if (opts->latency)
+		latencies = malloc(sizeof(uint64_t) * iterations);
+	if (!source || !dest || (opts->latency && !latencies))
+	{
+		fprintf(stderr, "Could not allocate %zu byte buffers.", buffer_size);
+		abort();
+	}
+
+	if (opts->warmup)
+	{
+		write_trace_marker(opts, "WARMUP", buffer_size, opts->warmup, -1);
+		run_kernel(opts->kernel, dest, source, buffer_size, opts->warmup, NULL);
+	}
+
+	write_trace_marker(opts, "START", buffer_size, iterations, -1);
+	struct timespec before, after;
+	if (clock_gettime(CLOCK_MONOTONIC, &before))
+	{
+	 	fprintf(stderr, "Could not get start time.");
+		abort();
+	}
+
+	run_kernel(opts->kernel, dest, source, buffer_size, iterations, latencies);
+
+	if (clock_gettime(CLOCK_MONOTONIC, &after))
+	{
+	 	fprintf(stderr, "Could not get end time.");
+		abort();
+	}
+	write_trace_marker(opts, "END", buffer_size, iterations, -1);
+
+	free_buffer(dest, buffer_size);
+	free_buffer(source, buffer_size);
+
+	double delta = timespec_delta(&before, &after);
+	struct latency_stats stats;
+	if (latencies)
+		get_latency_stats(latencies, iterations, &stats);
+	print_result(opts, "total", -1, buffer_size, iterations, delta,
+		     buffer_size / delta * iterations / 1e6, latencies ? &stats : NULL);
+	free(latencies);
+
+	return 0;
+}
+
+// Use every CPU the process may run on.
+size_t get_available_cpus(int **cpus)
+{
+	cpu_set_t mask;
+	size_t count = 0;
+	int i;
+
+	if (sched_getaffinity(0, sizeof(mask), &mask))
+	{
+		fprintf(stderr, "sched_getaffinity failed.");
+		abort();
+	}
+
+	*cpus = malloc(sizeof(int) * CPU_COUNT(&mask));
+	if (!*cpus)
+	{
+		fprintf(stderr, "Could not allocate CPU list.");
+		abort();
+	}
+	for (i = 0; i < CPU_SETSIZE; ++i)
+		if (CPU_ISSET(i, &mask))
+			(*cpus)[count++] = i;
+	return count;
 }
 
 int main(int argc, char** argv)
 {
-	int cpus[MAX_CPUS];
+	int *cpus = NULL;
 	int next_cpu = 0;
 	int iterations = DEFAULT_ITERATIONS;
-	int buffer_size = DEFAULT_BUFFER_SIZE;
-	
+	size_t buffer_size = DEFAULT_BUFFER_SIZE;
+	size_t sweep_min = 0, sweep_max = 0;
+	int threaded = 0;
+	struct options opts = { KERNEL_MEMCPY, 0, 0, 0, 0, 0, 0 };
+	char *sep;
+
 	int c;
-	while ((c = getopt(argc, argv, "i:c:s:")) != -1)
+	while ((c = getopt(argc, argv, "i:c:s:tk:w:HpmW:lT")) != -1)
 		switch (c)
 		{
 		case 'c':
-			cpus[next_cpu++] = atoi(optarg);
-			if (next_cpu == MAX_CPUS)
+			cpus = realloc(cpus, sizeof(int) * (next_cpu + 1));
+			cpus[next_cpu] = atoi(optarg);
+			if (cpus[next_cpu] < 0 || cpus[next_cpu] >= CPU_SETSIZE)
 			{
-				fprintf(stderr, "Max CPUs exceeded.");
+				fprintf(stderr, "Invalid CPU %s.", optarg);
 				abort();
 			}
+			next_cpu++;
 			break;
 		case 'i':
 			iterations = atoi(optarg);
+			if (iterations < 1)
+			{
+				fprintf(stderr, "Invalid number of iterations %s.", optarg);
+				abort();
+			}
 			break;
 		case 's':
-			buffer_size = atoi(optarg);
+			buffer_size = parse_size(optarg);
+			break;
+		case 't':
+			threaded = 1;
+			break;
+		case 'k':
+			opts.kernel = parse_kernel(optarg);
+			break;
+		case 'w':
+			sep = strchr(optarg, ':');
+			if (!sep)
+			{
+				fprintf(stderr, "Sweep must be specified as MIN:MAX.");
+				abort();
+			}
+			*sep = '\0';
+			sweep_min = parse_size(optarg);
+			sweep_max = parse_size(sep + 1);
+			if (!sweep_min || sweep_max < sweep_min)
+			{
+				fprintf(stderr, "Invalid sweep range.");
+				abort();
+			}
+			break;
+		case 'H':
+			opts.huge_pages = 1;
+			break;
+		case 'p':
+			opts.prefault = 1;
+			break;
+		case 'm':
+			opts.csv = 1;
+			break;
+		case 'W':
+			opts.warmup = atoi(optarg);
+			break;
+		case 'l':
+			opts.latency = 1;
+			break;
+		case 'T':
+			opts.trace = 1;
 			break;
 		default:
 			abort();
 			break;
 		}
 
-	int ret;
-	if (next_cpu != 0)
-		if (ret = set_affinity(next_cpu, cpus))
+	// Reads of an untouched buffer all hit the zero page, which would make
+	// the read kernel measure the cache rather than the memory hierarchy.
+	if (opts.kernel == KERNEL_READ)
+		opts.prefault = 1;
+
+	if (threaded)
+	{
+		if (next_cpu == 0)
+			next_cpu = get_available_cpus(&cpus);
+	}
+	else if (next_cpu != 0)
+	{
+		int ret;
+		if ((ret = set_affinity(next_cpu, cpus)))
 		{
 			fprintf(stderr, "sched_setaffinity returnred %i.", ret);
 			abort();
 		}
-	
-	char* source  = malloc(buffer_size);
-	char* dest = malloc(buffer_size);
+	}
 
-	struct timespec before, after;
-	if (clock_gettime(CLOCK_MONOTONIC, &before))
+	if (opts.trace)
 	{
-	 	fprintf(stderr, "Could not get start time.");
-		abort();
+		int ret = open_trace_marker();
+		if (ret)
+		{
+			fprintf(stderr, "Could not open trace_marker: %s.", strerror(-ret));
+			abort();
+		}
 	}
 
-	int i;
-	for (i = 0; i < iterations; ++i)
+	if (opts.csv)
+		printf("kernel,size,iterations,thread,cpu,time,bandwidth,"
+		       "latency_min,latency_median,latency_p99,latency_max\n");
+
+	if (!sweep_min)
 	{
-		memcpy(dest, source, buffer_size);
+		if (threaded)
+			run_threads(next_cpu, cpus, iterations, buffer_size, &opts);
+		else
+			run_single(iterations, buffer_size, &opts);
 	}
-
-	if (clock_gettime(CLOCK_MONOTONIC, &after))
+	else
 	{
-	 	fprintf(stderr, "Could not get end time.");
-		abort();
+		// Double the buffer size at each step, scaling the iterations so
+		// that each step processes about as much data as the -i and -s
+		// options specify.
+		double total = (double)iterations * buffer_size;
+		size_t size;
+		for (size = sweep_min; size <= sweep_max; size *= 2)
+		{
+			int step_iterations = total / size;
+			if (step_iterations < 1)
+				step_iterations = 1;
+			if (threaded)
+				run_threads(next_cpu, cpus, step_iterations, size, &opts);
+			else
+				run_single(step_iterations, size, &opts);
+			fflush(stdout);
+		}
 	}
 
-	free(dest);
-	free(source);
-
-	long delta_sec =  (long)(after.tv_sec - before.tv_sec);
-	long delta_nsec = after.tv_nsec - before.tv_nsec;
-	double delta = (double)delta_sec + delta_nsec / 1e9;
-	printf("Total time: %f s\n", delta);
-	printf("Bandwidth: %f MB/s\n", buffer_size / delta * iterations / 1e6);
-
+	if (trace_marker_fd >= 0)
+		close(trace_marker_fd);
+	free(cpus);
 	return 0;
 }
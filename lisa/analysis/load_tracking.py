@@ -87,7 +87,7 @@ class LoadTrackingAnalysis(TraceAnalysisBase):
         The extra columns not shared between trace event versions
         """
         if event in [*cls._SCHED_PELT_CFS_NAMES, 'sched_load_se', 'sched_pelt_se']:
-            return ['path', 'rbl_load', 'runnable']
+            return ['path', 'cgroup_id', 'rbl_load', 'runnable']
 
         if event in ['sched_load_avg_task']:
             return ['load_sum', 'period_contrib', 'util_sum']
@@ -99,8 +99,16 @@ class LoadTrackingAnalysis(TraceAnalysisBase):
 
         df = df.rename(columns=self._columns_renaming(event), copy=True)
 
-        # Legacy sched_load_avg_* events don't have a `path` field.
-        if not event.startswith('sched_load_avg_'):
+        # Legacy sched_load_avg_* events don't have a `path` field. The
+        # sched_tp module only records the cgroup_id, which is 0 for
+        # "(null)" and 1 for "/".
+        if 'cgroup_id' in df.columns and 'path' not in df.columns:
+            if event in self._SCHED_PELT_SE_NAMES:
+                df = df[df.cgroup_id == 0]
+
+            if event in self._SCHED_PELT_CFS_NAMES:
+                df = df[df.cgroup_id == 1]
+        elif not event.startswith('sched_load_avg_'):
             if event in self._SCHED_PELT_SE_NAMES:
                 df = df[df.path == "(null)"]
 
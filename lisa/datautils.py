@@ -2012,6 +2012,7 @@ _SIGNALS = [
 
     SignalDesc('sched_util_est_cfs', ['cpu']),
     SignalDesc('sched_pelt_cfs', ['path', 'cpu']),
+    SignalDesc('sched_pelt_cfs', ['cgroup_id', 'cpu']),
     SignalDesc('sched_load_cfs_rq', ['path', 'cpu']),
     SignalDesc('sched_pelt_irq', ['cpu']),
     SignalDesc('sched_pelt_rt', ['cpu']),
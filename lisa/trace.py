@@ -597,6 +597,7 @@ class TxtTraceParserBase(TraceParserBase):
         'pid': 'uint32',
         'comm': 'string',
         'cgroup_path': 'string',
+        'cgroup_id': 'uint32',
         # prio in [-1, 140]
         'prio': 'int16',
         'util': 'uint16',
@@ -1234,6 +1235,30 @@ class TxtTraceParser(TxtTraceParserBase):
             },
             raw=False,
         ),
+        'sched_select_task_rq': dict(
+            fields={
+                'comm': _KERNEL_DTYPE['comm'],
+                'pid': _KERNEL_DTYPE['pid'],
+                'prev_cpu': _KERNEL_DTYPE['cpu'],
+                'target_cpu': _KERNEL_DTYPE['cpu'],
+                'wake_flags': 'uint32',
+                'delta': 'uint64',
+                'cpus': 'string',
+            },
+            # cpus is a bitmask, which is displayed as an array of bytes in
+            # raw mode
+            raw=False,
+        ),
+        'sched_find_energy_efficient_cpu': dict(
+            fields={
+                'comm': _KERNEL_DTYPE['comm'],
+                'pid': _KERNEL_DTYPE['pid'],
+                'util': _KERNEL_DTYPE['util'],
+                'prev_cpu': _KERNEL_DTYPE['cpu'],
+                'target_cpu': 'int32',
+                'delta': 'uint64',
+            },
+        ),
         'sched_switch': dict(
             fields={
                 'prev_comm': _KERNEL_DTYPE['comm'],
@@ -1282,6 +1307,12 @@ class TxtTraceParser(TxtTraceParserBase):
                 'prev_cpu': _KERNEL_DTYPE['cpu'],
             },
         ),
+        'sched_cgroup_path': dict(
+            fields={
+                'cgroup_id': _KERNEL_DTYPE['cgroup_id'],
+                'path': _KERNEL_DTYPE['cgroup_path'],
+            },
+        ),
         'sched_cpu_capacity': dict(
             fields={
                 'cpu': _KERNEL_DTYPE['cpu'],
@@ -1293,7 +1324,7 @@ class TxtTraceParser(TxtTraceParserBase):
             fields={
                 'cpu': _KERNEL_DTYPE['cpu'],
                 'load': _KERNEL_DTYPE['util'],
-                'path': _KERNEL_DTYPE['cgroup_path'],
+                'cgroup_id': _KERNEL_DTYPE['cgroup_id'],
                 'rbl_load': _KERNEL_DTYPE['util'],
                 'util': _KERNEL_DTYPE['util'],
             },
@@ -1303,13 +1334,83 @@ class TxtTraceParser(TxtTraceParserBase):
                 'comm': _KERNEL_DTYPE['comm'],
                 'cpu': _KERNEL_DTYPE['cpu'],
                 'load': _KERNEL_DTYPE['util'],
-                'path': _KERNEL_DTYPE['cgroup_path'],
+                'cgroup_id': _KERNEL_DTYPE['cgroup_id'],
                 'pid': _KERNEL_DTYPE['pid'],
                 'rbl_load': _KERNEL_DTYPE['util'],
                 'util': _KERNEL_DTYPE['util'],
                 'update_time': _KERNEL_DTYPE['timestamp'],
             },
         ),
+        'sched_pelt_cfs_compact': dict(
+            fields={
+                'cpu': _KERNEL_DTYPE['cpu'],
+                'cgroup_id': _KERNEL_DTYPE['cgroup_id'],
+                'load': 'uint32',
+                'rbl_load': 'uint32',
+                'runnable': 'uint32',
+                'util': _KERNEL_DTYPE['util'],
+            },
+        ),
+        'sched_pelt_se_compact': dict(
+            fields={
+                'cpu': _KERNEL_DTYPE['cpu'],
+                'cgroup_id': _KERNEL_DTYPE['cgroup_id'],
+                'comm': _KERNEL_DTYPE['comm'],
+                'pid': _KERNEL_DTYPE['pid'],
+                'load': 'uint32',
+                'rbl_load': 'uint32',
+                'runnable': 'uint32',
+                'util': _KERNEL_DTYPE['util'],
+            },
+        ),
+        'sched_pelt_cfs_aggr': dict(
+            fields={
+                'cpu': _KERNEL_DTYPE['cpu'],
+                'cgroup_id': _KERNEL_DTYPE['cgroup_id'],
+                'path': _KERNEL_DTYPE['cgroup_path'],
+                'start': _KERNEL_DTYPE['timestamp'],
+                'last_update': _KERNEL_DTYPE['timestamp'],
+                'nr': 'uint32',
+                'evicted': 'bool',
+                'load': _KERNEL_DTYPE['util'],
+                'load_min': _KERNEL_DTYPE['util'],
+                'load_max': _KERNEL_DTYPE['util'],
+                'rbl_load': _KERNEL_DTYPE['util'],
+                'rbl_load_min': _KERNEL_DTYPE['util'],
+                'rbl_load_max': _KERNEL_DTYPE['util'],
+                'runnable': _KERNEL_DTYPE['util'],
+                'runnable_min': _KERNEL_DTYPE['util'],
+                'runnable_max': _KERNEL_DTYPE['util'],
+                'util': _KERNEL_DTYPE['util'],
+                'util_min': _KERNEL_DTYPE['util'],
+                'util_max': _KERNEL_DTYPE['util'],
+            },
+        ),
+        'sched_pelt_se_aggr': dict(
+            fields={
+                'cpu': _KERNEL_DTYPE['cpu'],
+                'cgroup_id': _KERNEL_DTYPE['cgroup_id'],
+                'path': _KERNEL_DTYPE['cgroup_path'],
+                'comm': _KERNEL_DTYPE['comm'],
+                'pid': _KERNEL_DTYPE['pid'],
+                'start': _KERNEL_DTYPE['timestamp'],
+                'last_update': _KERNEL_DTYPE['timestamp'],
+                'nr': 'uint32',
+                'evicted': 'bool',
+                'load': _KERNEL_DTYPE['util'],
+                'load_min': _KERNEL_DTYPE['util'],
+                'load_max': _KERNEL_DTYPE['util'],
+                'rbl_load': _KERNEL_DTYPE['util'],
+                'rbl_load_min': _KERNEL_DTYPE['util'],
+                'rbl_load_max': _KERNEL_DTYPE['util'],
+                'runnable': _KERNEL_DTYPE['util'],
+                'runnable_min': _KERNEL_DTYPE['util'],
+                'runnable_max': _KERNEL_DTYPE['util'],
+                'util': _KERNEL_DTYPE['util'],
+                'util_min': _KERNEL_DTYPE['util'],
+                'util_max': _KERNEL_DTYPE['util'],
+            },
+        ),
         'sched_migrate_task': dict(
             fields={
                 'comm': _KERNEL_DTYPE['comm'],
@@ -1324,6 +1425,9 @@ class TxtTraceParser(TxtTraceParserBase):
                 'overutilized': 'bool',
                 'span': 'string',
             },
+            # span is a bitmask, which is displayed as an array of bytes in
+            # raw mode
+            raw=False,
         ),
         'sched_pelt_dl': dict(
             fields={
@@ -1359,7 +1463,7 @@ class TxtTraceParser(TxtTraceParserBase):
         'sched_util_est_cfs': dict(
             fields={
                 'cpu': _KERNEL_DTYPE['cpu'],
-                'path': _KERNEL_DTYPE['cgroup_path'],
+                'cgroup_id': _KERNEL_DTYPE['cgroup_id'],
                 'enqueued': _KERNEL_DTYPE['util'],
                 'ewma': _KERNEL_DTYPE['util'],
                 'util': _KERNEL_DTYPE['util'],
@@ -1370,7 +1474,27 @@ class TxtTraceParser(TxtTraceParserBase):
                 'cpu': _KERNEL_DTYPE['cpu'],
                 'comm': _KERNEL_DTYPE['comm'],
                 'pid': _KERNEL_DTYPE['pid'],
-                'path': _KERNEL_DTYPE['cgroup_path'],
+                'cgroup_id': _KERNEL_DTYPE['cgroup_id'],
+                'enqueued': _KERNEL_DTYPE['util'],
+                'ewma': _KERNEL_DTYPE['util'],
+                'util': _KERNEL_DTYPE['util'],
+            },
+        ),
+        'sched_util_est_cfs_compact': dict(
+            fields={
+                'cpu': _KERNEL_DTYPE['cpu'],
+                'cgroup_id': _KERNEL_DTYPE['cgroup_id'],
+                'enqueued': _KERNEL_DTYPE['util'],
+                'ewma': _KERNEL_DTYPE['util'],
+                'util': _KERNEL_DTYPE['util'],
+            },
+        ),
+        'sched_util_est_se_compact': dict(
+            fields={
+                'cpu': _KERNEL_DTYPE['cpu'],
+                'cgroup_id': _KERNEL_DTYPE['cgroup_id'],
+                'comm': _KERNEL_DTYPE['comm'],
+                'pid': _KERNEL_DTYPE['pid'],
                 'enqueued': _KERNEL_DTYPE['util'],
                 'ewma': _KERNEL_DTYPE['util'],
                 'util': _KERNEL_DTYPE['util'],
@@ -3790,7 +3914,14 @@ class Trace(Loggable, TraceBase):
             signals_init = pd_desc['signals_init']
             compress_signals_init = pd_desc['compress_signals_init']
             cols_list = pd_desc['signals']
-            signals = [SignalDesc(event, cols) for cols in cols_list]
+            # Different versions of an event may identify their signals with
+            # different fields, e.g. sched_pelt_cfs switched from path to
+            # cgroup_id
+            signals = [
+                SignalDesc(event, cols)
+                for cols in cols_list
+                if set(cols) <= set(df.columns)
+            ]
 
             with measure_time() as measure:
                 if signals_init and signals:
@@ -4467,7 +4598,8 @@ class Trace(Loggable, TraceBase):
 
         if 'span' in df.columns and df['span'].dtype.name == 'string':
             df = copy_once(df)
-            df['span'] = df['span'].apply(lambda x: x if pd.isna(x) else int(x, base=16))
+            # Bitmasks are formatted as comma-separated groups of 32 bits
+            df['span'] = df['span'].apply(lambda x: x if pd.isna(x) else int(x.replace(',', ''), base=16))
 
         return df
 
@@ -312,6 +312,64 @@ class TestTrace(TraceTestCase):
         assert df.index.tolist() == [519.022643]
         assert df.cpu.tolist() == [2]
 
+    def test_sched_pelt_cgroup_id(self):
+        """
+        Test parsing the cgroup_id of the sched_tp module PELT events
+        """
+        self.events = [
+            'sched_pelt_cfs',
+            'sched_pelt_se',
+        ]
+        trace = self.make_trace("""
+          <idle>-0     [000]   519.021928: sched_pelt_cfs:       cpu=0 cgroup_id=1 load=100 rbl_load=100 util=120
+          <idle>-0     [000]   519.021930: sched_pelt_cfs:       cpu=0 cgroup_id=2 load=50 rbl_load=50 util=60
+          <idle>-0     [000]   519.021932: sched_pelt_se:        cpu=0 cgroup_id=0 comm=task1 pid=10 load=30 rbl_load=30 util=40 update_time=519021932000
+          <idle>-0     [000]   519.021934: sched_pelt_se:        cpu=0 cgroup_id=2 comm=(null) pid=-1 load=50 rbl_load=50 util=60 update_time=519021934000
+          <idle>-0     [001]   519.021936: sched_pelt_cfs:       cpu=1 cgroup_id=4294967295 load=10 rbl_load=10 util=20
+        """)
+
+        df = trace.df_event('sched_pelt_cfs')
+        assert df.cgroup_id.tolist() == [1, 2, 4294967295]
+        assert df.util.tolist() == [120, 60, 20]
+
+        df = trace.df_event('sched_pelt_se')
+        assert df.cgroup_id.tolist() == [0, 2]
+        assert df.comm.tolist() == ['task1', '(null)']
+
+        # Only the root cfs_rq and the task entities are reported as signals
+        df = trace.analysis.load_tracking.df_cpus_signal('util')
+        assert df.index.tolist() == [519.021928]
+        assert df.util.tolist() == [120]
+
+        df = trace.analysis.load_tracking.df_tasks_signal('util')
+        assert df.pid.tolist() == [10]
+        assert df.util.tolist() == [40]
+
+    def test_sched_pelt_aggr(self):
+        """
+        Test parsing the summaries of the sched_tp module aggregated PELT events
+        """
+        self.events = [
+            'sched_pelt_cfs_aggr',
+            'sched_pelt_se_aggr',
+        ]
+        trace = self.make_trace("""
+          <idle>-0     [000]   519.031928: sched_pelt_cfs_aggr:  cpu=0 cgroup_id=1 path=/ start=519021928000 last_update=519031000000 nr=12 evicted=0 load=100 load_min=90 load_max=110 runnable=100 runnable_min=90 runnable_max=110 util=120 util_min=100 util_max=130
+          <idle>-0     [000]   519.031930: sched_pelt_se_aggr:   cpu=0 cgroup_id=0 path=(null) comm=task1 pid=10 start=519021930000 last_update=519025000000 nr=3 evicted=1 load=30 load_min=10 load_max=40 runnable=30 runnable_min=10 runnable_max=40 util=40 util_min=20 util_max=60
+        """)
+
+        df = trace.df_event('sched_pelt_cfs_aggr')
+        assert df.cgroup_id.tolist() == [1]
+        assert df.start.tolist() == [519021928000]
+        assert df.last_update.tolist() == [519031000000]
+        assert df.nr.tolist() == [12]
+        assert df.util_max.tolist() == [130]
+
+        df = trace.df_event('sched_pelt_se_aggr')
+        assert df.pid.tolist() == [10]
+        assert df.evicted.tolist() == [True]
+        assert df.util_min.tolist() == [20]
+
     def _test_tasks_dfs(self, trace_name):
         """Helper for smoke testing _dfg methods in tasks_analysis"""
         trace = self.get_trace(trace_name)
@@ -2,37 +2,105 @@
 #undef TRACE_SYSTEM
 #define TRACE_SYSTEM sched
 
-#define MAX_SPAN_SIZE		128
-
 #if !defined(_SCHED_EVENTS_H) || defined(TRACE_HEADER_MULTI_READ)
 #define _SCHED_EVENTS_H
 
 #define PATH_SIZE		64
-#define __SPAN_SIZE		(round_up(NR_CPUS, 4)/4)
-#define SPAN_SIZE		(__SPAN_SIZE > MAX_SPAN_SIZE ? MAX_SPAN_SIZE : __SPAN_SIZE)
+
+/* Saturate PELT signals to fit the packed fields of the *_compact events */
+#define COMPACT_U16(x)		((u16)min_t(unsigned long, (x), U16_MAX))
+#define COMPACT_U32(x)		((u32)min_t(unsigned long, (x), U32_MAX))
 
 #include <linux/tracepoint.h>
 #include <linux/version.h>
 
 #if LINUX_VERSION_CODE <= KERNEL_VERSION(5,6,0)
 #define RBL_LOAD_ENTRY		rbl_load
+#define RBL_LOAD_MIN_ENTRY	rbl_load_min
+#define RBL_LOAD_MAX_ENTRY	rbl_load_max
 #define RBL_LOAD_MEMBER		runnable_load_avg
 #define RBL_LOAD_STR		"rbl_load"
 #else
 #define RBL_LOAD_ENTRY		runnable
+#define RBL_LOAD_MIN_ENTRY	runnable_min
+#define RBL_LOAD_MAX_ENTRY	runnable_max
 #define RBL_LOAD_MEMBER		runnable_avg
 #define RBL_LOAD_STR		"runnable"
 #endif
 
-TRACE_EVENT(sched_pelt_cfs,
-
-	TP_PROTO(int cpu, char *path, const struct sched_avg *avg),
+#ifndef _SCHED_EVENTS_TYPES
+#define _SCHED_EVENTS_TYPES
+
+struct pelt_stat {
+	unsigned long		min;
+	unsigned long		max;
+	unsigned long		last;
+};
+
+/*
+ * Accumulator of the PELT signals of one entity over a window, summarized by
+ * the sched_pelt_*_aggr events. The identity of the entity is captured when
+ * the window opens so that flushing never has to dereference @key. @evicted
+ * is set when the window is cut short to make room for another entity.
+ */
+struct pelt_aggr {
+	const void		*key;
+	u64			start;
+	u64			last_update;
+	unsigned int		nr;
+	bool			evicted;
+	int			cpu;
+	int			pid;
+	u32			cgroup_id;
+	char			path[PATH_SIZE];
+	char			comm[TASK_COMM_LEN];
+	struct pelt_stat	load;
+	struct pelt_stat	runnable;
+	struct pelt_stat	util;
+};
+
+/*
+ * Events enabling and disabling, which register the probes feeding them on
+ * demand, see sched_tp.c
+ */
+#define DECLARE_EVENT_REG(event)			\
+	static int event##_reg(void);			\
+	static void event##_unreg(void)
+
+DECLARE_EVENT_REG(sched_pelt_cfs);
+DECLARE_EVENT_REG(sched_pelt_rt);
+DECLARE_EVENT_REG(sched_pelt_dl);
+DECLARE_EVENT_REG(sched_pelt_irq);
+DECLARE_EVENT_REG(sched_pelt_se);
+DECLARE_EVENT_REG(sched_pelt_cfs_aggr);
+DECLARE_EVENT_REG(sched_pelt_se_aggr);
+DECLARE_EVENT_REG(sched_overutilized);
+DECLARE_EVENT_REG(sched_select_task_rq);
+DECLARE_EVENT_REG(sched_find_energy_efficient_cpu);
+DECLARE_EVENT_REG(sched_util_est_se);
+DECLARE_EVENT_REG(sched_util_est_cfs);
+DECLARE_EVENT_REG(sched_pelt_cfs_compact);
+DECLARE_EVENT_REG(sched_pelt_se_compact);
+DECLARE_EVENT_REG(sched_util_est_se_compact);
+DECLARE_EVENT_REG(sched_util_est_cfs_compact);
+
+#endif /* _SCHED_EVENTS_TYPES */
+
+/*
+ * The PELT and util_est events of cfs_rqs and entities only record the
+ * cgroup_id, sched_cgroup_path maps it to the cgroup path. @path is still
+ * passed so that all the variants share the same helpers.
+ */
+TRACE_EVENT_FN(sched_pelt_cfs,
+
+	TP_PROTO(int cpu, u32 cgroup_id, const char *path,
+		 const struct sched_avg *avg),
 
-	TP_ARGS(cpu, path, avg),
+	TP_ARGS(cpu, cgroup_id, path, avg),
 
 	TP_STRUCT__entry(
 		__field(	int,		cpu			)
-		__array(	char,		path,	PATH_SIZE	)
+		__field(	u32,		cgroup_id		)
 		__field(	unsigned long,	load			)
 		__field(	unsigned long,	RBL_LOAD_ENTRY		)
 		__field(	unsigned long,	util			)
@@ -40,15 +108,17 @@ TRACE_EVENT(sched_pelt_cfs,
 
 	TP_fast_assign(
 		__entry->cpu		= cpu;
-		strlcpy(__entry->path, path, PATH_SIZE);
+		__entry->cgroup_id	= cgroup_id;
 		__entry->load		= avg->load_avg;
 		__entry->RBL_LOAD_ENTRY	= avg->RBL_LOAD_MEMBER;
 		__entry->util		= avg->util_avg;
 	),
 
-	TP_printk("cpu=%d path=%s load=%lu " RBL_LOAD_STR "=%lu util=%lu",
-		  __entry->cpu, __entry->path, __entry->load,
-		  __entry->RBL_LOAD_ENTRY,__entry->util)
+	TP_printk("cpu=%d cgroup_id=%u load=%lu " RBL_LOAD_STR "=%lu util=%lu",
+		  __entry->cpu, __entry->cgroup_id, __entry->load,
+		  __entry->RBL_LOAD_ENTRY,__entry->util),
+
+	sched_pelt_cfs_reg, sched_pelt_cfs_unreg
 );
 
 DECLARE_EVENT_CLASS(sched_pelt_rq_template,
@@ -76,27 +146,31 @@ DECLARE_EVENT_CLASS(sched_pelt_rq_template,
 		  __entry->RBL_LOAD_ENTRY,__entry->util)
 );
 
-DEFINE_EVENT(sched_pelt_rq_template, sched_pelt_rt,
+DEFINE_EVENT_FN(sched_pelt_rq_template, sched_pelt_rt,
 	TP_PROTO(int cpu, const struct sched_avg *avg),
-	TP_ARGS(cpu, avg));
+	TP_ARGS(cpu, avg),
+	sched_pelt_rt_reg, sched_pelt_rt_unreg);
 
-DEFINE_EVENT(sched_pelt_rq_template, sched_pelt_dl,
+DEFINE_EVENT_FN(sched_pelt_rq_template, sched_pelt_dl,
 	TP_PROTO(int cpu, const struct sched_avg *avg),
-	TP_ARGS(cpu, avg));
+	TP_ARGS(cpu, avg),
+	sched_pelt_dl_reg, sched_pelt_dl_unreg);
 
-DEFINE_EVENT(sched_pelt_rq_template, sched_pelt_irq,
+DEFINE_EVENT_FN(sched_pelt_rq_template, sched_pelt_irq,
 	TP_PROTO(int cpu, const struct sched_avg *avg),
-	TP_ARGS(cpu, avg));
+	TP_ARGS(cpu, avg),
+	sched_pelt_irq_reg, sched_pelt_irq_unreg);
 
-TRACE_EVENT(sched_pelt_se,
+TRACE_EVENT_FN(sched_pelt_se,
 
-	TP_PROTO(int cpu, char *path, char *comm, int pid, const struct sched_avg *avg),
+	TP_PROTO(int cpu, u32 cgroup_id, const char *path, char *comm, int pid,
+		 const struct sched_avg *avg),
 
-	TP_ARGS(cpu, path, comm, pid, avg),
+	TP_ARGS(cpu, cgroup_id, path, comm, pid, avg),
 
 	TP_STRUCT__entry(
 		__field(	int,		cpu			)
-		__array(	char,		path,	PATH_SIZE	)
+		__field(	u32,		cgroup_id		)
 		__array(	char,		comm,	TASK_COMM_LEN	)
 		__field(	int,		pid			)
 		__field(	unsigned long,	load			)
@@ -107,7 +181,7 @@ TRACE_EVENT(sched_pelt_se,
 
 	TP_fast_assign(
 		__entry->cpu		= cpu;
-		strlcpy(__entry->path, path, PATH_SIZE);
+		__entry->cgroup_id	= cgroup_id;
 		strlcpy(__entry->comm, comm, TASK_COMM_LEN);
 		__entry->pid		= pid;
 		__entry->load		= avg->load_avg;
@@ -116,41 +190,250 @@ TRACE_EVENT(sched_pelt_se,
 		__entry->update_time    = avg->last_update_time;
 	),
 
-	TP_printk("cpu=%d path=%s comm=%s pid=%d load=%lu " RBL_LOAD_STR "=%lu util=%lu update_time=%llu",
-		  __entry->cpu, __entry->path, __entry->comm, __entry->pid,
-		  __entry->load, __entry->RBL_LOAD_ENTRY,__entry->util, __entry->update_time)
+	TP_printk("cpu=%d cgroup_id=%u comm=%s pid=%d load=%lu " RBL_LOAD_STR "=%lu util=%lu update_time=%llu",
+		  __entry->cpu, __entry->cgroup_id, __entry->comm, __entry->pid,
+		  __entry->load, __entry->RBL_LOAD_ENTRY,__entry->util, __entry->update_time),
+
+	sched_pelt_se_reg, sched_pelt_se_unreg
+);
+
+TRACE_EVENT_FN(sched_pelt_cfs_aggr,
+
+	TP_PROTO(const struct pelt_aggr *aggr),
+
+	TP_ARGS(aggr),
+
+	TP_STRUCT__entry(
+		__field(	int,		cpu			)
+		__field(	u32,		cgroup_id		)
+		__array(	char,		path,	PATH_SIZE	)
+		__field(	u64,		start			)
+		__field(	u64,		last_update		)
+		__field(	unsigned int,	nr			)
+		__field(	unsigned int,	evicted			)
+		__field(	unsigned long,	load			)
+		__field(	unsigned long,	load_min		)
+		__field(	unsigned long,	load_max		)
+		__field(	unsigned long,	RBL_LOAD_ENTRY		)
+		__field(	unsigned long,	RBL_LOAD_MIN_ENTRY	)
+		__field(	unsigned long,	RBL_LOAD_MAX_ENTRY	)
+		__field(	unsigned long,	util			)
+		__field(	unsigned long,	util_min		)
+		__field(	unsigned long,	util_max		)
+	),
+
+	TP_fast_assign(
+		__entry->cpu			= aggr->cpu;
+		__entry->cgroup_id		= aggr->cgroup_id;
+		strlcpy(__entry->path, aggr->path, PATH_SIZE);
+		__entry->start			= aggr->start;
+		__entry->last_update		= aggr->last_update;
+		__entry->nr			= aggr->nr;
+		__entry->evicted		= aggr->evicted;
+		__entry->load			= aggr->load.last;
+		__entry->load_min		= aggr->load.min;
+		__entry->load_max		= aggr->load.max;
+		__entry->RBL_LOAD_ENTRY		= aggr->runnable.last;
+		__entry->RBL_LOAD_MIN_ENTRY	= aggr->runnable.min;
+		__entry->RBL_LOAD_MAX_ENTRY	= aggr->runnable.max;
+		__entry->util			= aggr->util.last;
+		__entry->util_min		= aggr->util.min;
+		__entry->util_max		= aggr->util.max;
+	),
+
+	TP_printk("cpu=%d cgroup_id=%u path=%s start=%llu last_update=%llu nr=%u evicted=%u "
+		  "load=%lu load_min=%lu load_max=%lu "
+		  RBL_LOAD_STR "=%lu " RBL_LOAD_STR "_min=%lu " RBL_LOAD_STR "_max=%lu "
+		  "util=%lu util_min=%lu util_max=%lu",
+		  __entry->cpu, __entry->cgroup_id, __entry->path,
+		  __entry->start, __entry->last_update, __entry->nr, __entry->evicted,
+		  __entry->load, __entry->load_min, __entry->load_max,
+		  __entry->RBL_LOAD_ENTRY, __entry->RBL_LOAD_MIN_ENTRY,
+		  __entry->RBL_LOAD_MAX_ENTRY,
+		  __entry->util, __entry->util_min, __entry->util_max),
+
+	sched_pelt_cfs_aggr_reg, sched_pelt_cfs_aggr_unreg
+);
+
+TRACE_EVENT_FN(sched_pelt_se_aggr,
+
+	TP_PROTO(const struct pelt_aggr *aggr),
+
+	TP_ARGS(aggr),
+
+	TP_STRUCT__entry(
+		__field(	int,		cpu			)
+		__field(	u32,		cgroup_id		)
+		__array(	char,		path,	PATH_SIZE	)
+		__array(	char,		comm,	TASK_COMM_LEN	)
+		__field(	int,		pid			)
+		__field(	u64,		start			)
+		__field(	u64,		last_update		)
+		__field(	unsigned int,	nr			)
+		__field(	unsigned int,	evicted			)
+		__field(	unsigned long,	load			)
+		__field(	unsigned long,	load_min		)
+		__field(	unsigned long,	load_max		)
+		__field(	unsigned long,	RBL_LOAD_ENTRY		)
+		__field(	unsigned long,	RBL_LOAD_MIN_ENTRY	)
+		__field(	unsigned long,	RBL_LOAD_MAX_ENTRY	)
+		__field(	unsigned long,	util			)
+		__field(	unsigned long,	util_min		)
+		__field(	unsigned long,	util_max		)
+	),
+
+	TP_fast_assign(
+		__entry->cpu			= aggr->cpu;
+		__entry->cgroup_id		= aggr->cgroup_id;
+		strlcpy(__entry->path, aggr->path, PATH_SIZE);
+		strlcpy(__entry->comm, aggr->comm, TASK_COMM_LEN);
+		__entry->pid			= aggr->pid;
+		__entry->start			= aggr->start;
+		__entry->last_update		= aggr->last_update;
+		__entry->nr			= aggr->nr;
+		__entry->evicted		= aggr->evicted;
+		__entry->load			= aggr->load.last;
+		__entry->load_min		= aggr->load.min;
+		__entry->load_max		= aggr->load.max;
+		__entry->RBL_LOAD_ENTRY		= aggr->runnable.last;
+		__entry->RBL_LOAD_MIN_ENTRY	= aggr->runnable.min;
+		__entry->RBL_LOAD_MAX_ENTRY	= aggr->runnable.max;
+		__entry->util			= aggr->util.last;
+		__entry->util_min		= aggr->util.min;
+		__entry->util_max		= aggr->util.max;
+	),
+
+	TP_printk("cpu=%d cgroup_id=%u path=%s comm=%s pid=%d start=%llu last_update=%llu nr=%u evicted=%u "
+		  "load=%lu load_min=%lu load_max=%lu "
+		  RBL_LOAD_STR "=%lu " RBL_LOAD_STR "_min=%lu " RBL_LOAD_STR "_max=%lu "
+		  "util=%lu util_min=%lu util_max=%lu",
+		  __entry->cpu, __entry->cgroup_id, __entry->path, __entry->comm, __entry->pid,
+		  __entry->start, __entry->last_update, __entry->nr, __entry->evicted,
+		  __entry->load, __entry->load_min, __entry->load_max,
+		  __entry->RBL_LOAD_ENTRY, __entry->RBL_LOAD_MIN_ENTRY,
+		  __entry->RBL_LOAD_MAX_ENTRY,
+		  __entry->util, __entry->util_min, __entry->util_max),
+
+	sched_pelt_se_aggr_reg, sched_pelt_se_aggr_unreg
+);
+
+TRACE_EVENT(sched_cgroup_path,
+
+	TP_PROTO(u32 cgroup_id, const char *path),
+
+	TP_ARGS(cgroup_id, path),
+
+	TP_STRUCT__entry(
+		__field(	u32,		cgroup_id		)
+		__array(	char,		path,	PATH_SIZE	)
+	),
+
+	TP_fast_assign(
+		__entry->cgroup_id	= cgroup_id;
+		strlcpy(__entry->path, path, PATH_SIZE);
+	),
+
+	TP_printk("cgroup_id=%u path=%s", __entry->cgroup_id, __entry->path)
 );
 
-TRACE_EVENT(sched_overutilized,
+TRACE_EVENT_FN(sched_overutilized,
 
-	TP_PROTO(int overutilized, char *span),
+	TP_PROTO(int overutilized, const struct cpumask *span),
 
 	TP_ARGS(overutilized, span),
 
 	TP_STRUCT__entry(
 		__field(	int,		overutilized		)
-		__array(	char,		span,	SPAN_SIZE	)
+		__bitmask(	span,		nr_cpu_ids	)
 	),
 
 	TP_fast_assign(
 		__entry->overutilized	= overutilized;
-		strlcpy(__entry->span, span, SPAN_SIZE);
+		__assign_bitmask(span, cpumask_bits(span), nr_cpu_ids);
 	),
 
 	TP_printk("overutilized=%d span=0x%s",
-		  __entry->overutilized, __entry->span)
+		  __entry->overutilized, __get_bitmask(span)),
+
+	sched_overutilized_reg, sched_overutilized_unreg
+);
+
+TRACE_EVENT_FN(sched_select_task_rq,
+
+	TP_PROTO(struct task_struct *p, int prev_cpu, int target_cpu,
+		 int wake_flags, u64 delta),
+
+	TP_ARGS(p, prev_cpu, target_cpu, wake_flags, delta),
+
+	TP_STRUCT__entry(
+		__array(	char,		comm,	TASK_COMM_LEN	)
+		__field(	int,		pid			)
+		__field(	int,		prev_cpu		)
+		__field(	int,		target_cpu		)
+		__field(	int,		wake_flags		)
+		__field(	u64,		delta			)
+		__bitmask(	cpus,		nr_cpu_ids	)
+	),
+
+	TP_fast_assign(
+		strlcpy(__entry->comm, p->comm, TASK_COMM_LEN);
+		__entry->pid		= p->pid;
+		__entry->prev_cpu	= prev_cpu;
+		__entry->target_cpu	= target_cpu;
+		__entry->wake_flags	= wake_flags;
+		__entry->delta		= delta;
+		__assign_bitmask(cpus, cpumask_bits(p->cpus_ptr), nr_cpu_ids);
+	),
+
+	TP_printk("comm=%s pid=%d prev_cpu=%d target_cpu=%d wake_flags=0x%x delta=%llu cpus=0x%s",
+		  __entry->comm, __entry->pid, __entry->prev_cpu,
+		  __entry->target_cpu, __entry->wake_flags, __entry->delta,
+		  __get_bitmask(cpus)),
+
+	sched_select_task_rq_reg, sched_select_task_rq_unreg
 );
 
-TRACE_EVENT(sched_util_est_se,
+TRACE_EVENT_FN(sched_find_energy_efficient_cpu,
+
+	TP_PROTO(struct task_struct *p, int prev_cpu, int target_cpu, u64 delta),
 
-	TP_PROTO(int cpu, char *path, char *comm, int pid,
+	TP_ARGS(p, prev_cpu, target_cpu, delta),
+
+	TP_STRUCT__entry(
+		__array(	char,		comm,	TASK_COMM_LEN	)
+		__field(	int,		pid			)
+		__field(	unsigned long,	util			)
+		__field(	int,		prev_cpu		)
+		__field(	int,		target_cpu		)
+		__field(	u64,		delta			)
+	),
+
+	TP_fast_assign(
+		strlcpy(__entry->comm, p->comm, TASK_COMM_LEN);
+		__entry->pid		= p->pid;
+		__entry->util		= p->se.avg.util_avg;
+		__entry->prev_cpu	= prev_cpu;
+		__entry->target_cpu	= target_cpu;
+		__entry->delta		= delta;
+	),
+
+	TP_printk("comm=%s pid=%d util=%lu prev_cpu=%d target_cpu=%d delta=%llu",
+		  __entry->comm, __entry->pid, __entry->util, __entry->prev_cpu,
+		  __entry->target_cpu, __entry->delta),
+
+	sched_find_energy_efficient_cpu_reg, sched_find_energy_efficient_cpu_unreg
+);
+
+TRACE_EVENT_FN(sched_util_est_se,
+
+	TP_PROTO(int cpu, u32 cgroup_id, const char *path, char *comm, int pid,
 		 const struct sched_avg *avg),
 
-	TP_ARGS(cpu, path, comm, pid, avg),
+	TP_ARGS(cpu, cgroup_id, path, comm, pid, avg),
 
 	TP_STRUCT__entry(
 		__field(	int,		cpu			)
-		__array(	char,		path,	PATH_SIZE	)
+		__field(	u32,		cgroup_id		)
 		__array(	char,		comm,	TASK_COMM_LEN	)
 		__field(	int,		pid			)
 		__field( 	unsigned int,	enqueued		)
@@ -160,7 +443,7 @@ TRACE_EVENT(sched_util_est_se,
 
 	TP_fast_assign(
 		__entry->cpu		= cpu;
-		strlcpy(__entry->path, path, PATH_SIZE);
+		__entry->cgroup_id	= cgroup_id;
 		strlcpy(__entry->comm, comm, TASK_COMM_LEN);
 		__entry->pid		= pid;
 		__entry->enqueued	= avg->util_est.enqueued;
@@ -168,20 +451,23 @@ TRACE_EVENT(sched_util_est_se,
 		__entry->util		= avg->util_avg;
 	),
 
-	TP_printk("cpu=%d path=%s comm=%s pid=%d enqueued=%u ewma=%u util=%lu",
-		  __entry->cpu, __entry->path, __entry->comm, __entry->pid,
-		  __entry->enqueued, __entry->ewma, __entry->util)
+	TP_printk("cpu=%d cgroup_id=%u comm=%s pid=%d enqueued=%u ewma=%u util=%lu",
+		  __entry->cpu, __entry->cgroup_id, __entry->comm, __entry->pid,
+		  __entry->enqueued, __entry->ewma, __entry->util),
+
+	sched_util_est_se_reg, sched_util_est_se_unreg
 );
 
-TRACE_EVENT(sched_util_est_cfs,
+TRACE_EVENT_FN(sched_util_est_cfs,
 
-	TP_PROTO(int cpu, char *path, const struct sched_avg *avg),
+	TP_PROTO(int cpu, u32 cgroup_id, const char *path,
+		 const struct sched_avg *avg),
 
-	TP_ARGS(cpu, path, avg),
+	TP_ARGS(cpu, cgroup_id, path, avg),
 
 	TP_STRUCT__entry(
 		__field(	int,		cpu			)
-		__array(	char,		path,	PATH_SIZE	)
+		__field(	u32,		cgroup_id		)
 		__field( 	unsigned int,	enqueued		)
 		__field( 	unsigned int,	ewma			)
 		__field(	unsigned long,	util			)
@@ -189,15 +475,149 @@ TRACE_EVENT(sched_util_est_cfs,
 
 	TP_fast_assign(
 		__entry->cpu		= cpu;
-		strlcpy(__entry->path, path, PATH_SIZE);
+		__entry->cgroup_id	= cgroup_id;
 		__entry->enqueued	= avg->util_est.enqueued;
 		__entry->ewma		= avg->util_est.ewma;
 		__entry->util		= avg->util_avg;
 	),
 
-	TP_printk("cpu=%d path=%s enqueued=%u ewma=%u util=%lu",
-		  __entry->cpu, __entry->path, __entry->enqueued,
-		 __entry->ewma, __entry->util)
+	TP_printk("cpu=%d cgroup_id=%u enqueued=%u ewma=%u util=%lu",
+		  __entry->cpu, __entry->cgroup_id, __entry->enqueued,
+		 __entry->ewma, __entry->util),
+
+	sched_util_est_cfs_reg, sched_util_est_cfs_unreg
+);
+
+/*
+ * Compact variants of the events above: packed fields and dynamic comm. They
+ * take the same arguments so that they can be fed by the same helpers.
+ */
+TRACE_EVENT_FN(sched_pelt_cfs_compact,
+
+	TP_PROTO(int cpu, u32 cgroup_id, const char *path,
+		 const struct sched_avg *avg),
+
+	TP_ARGS(cpu, cgroup_id, path, avg),
+
+	TP_STRUCT__entry(
+		__field(	u32,		cgroup_id		)
+		__field(	u32,		load			)
+		__field(	u32,		RBL_LOAD_ENTRY		)
+		__field(	u16,		cpu			)
+		__field(	u16,		util			)
+	),
+
+	TP_fast_assign(
+		__entry->cgroup_id	= cgroup_id;
+		__entry->load		= COMPACT_U32(avg->load_avg);
+		__entry->RBL_LOAD_ENTRY	= COMPACT_U32(avg->RBL_LOAD_MEMBER);
+		__entry->cpu		= cpu;
+		__entry->util		= COMPACT_U16(avg->util_avg);
+	),
+
+	TP_printk("cpu=%u cgroup_id=%u load=%u " RBL_LOAD_STR "=%u util=%u",
+		  __entry->cpu, __entry->cgroup_id, __entry->load,
+		  __entry->RBL_LOAD_ENTRY, __entry->util),
+
+	sched_pelt_cfs_compact_reg, sched_pelt_cfs_compact_unreg
+);
+
+TRACE_EVENT_FN(sched_pelt_se_compact,
+
+	TP_PROTO(int cpu, u32 cgroup_id, const char *path, char *comm, int pid,
+		 const struct sched_avg *avg),
+
+	TP_ARGS(cpu, cgroup_id, path, comm, pid, avg),
+
+	TP_STRUCT__entry(
+		__field(	u32,		cgroup_id		)
+		__field(	int,		pid			)
+		__field(	u32,		load			)
+		__field(	u32,		RBL_LOAD_ENTRY		)
+		__field(	u16,		cpu			)
+		__field(	u16,		util			)
+		__string(	comm,		comm			)
+	),
+
+	TP_fast_assign(
+		__entry->cgroup_id	= cgroup_id;
+		__entry->pid		= pid;
+		__entry->load		= COMPACT_U32(avg->load_avg);
+		__entry->RBL_LOAD_ENTRY	= COMPACT_U32(avg->RBL_LOAD_MEMBER);
+		__entry->cpu		= cpu;
+		__entry->util		= COMPACT_U16(avg->util_avg);
+		__assign_str(comm, comm);
+	),
+
+	TP_printk("cpu=%u cgroup_id=%u comm=%s pid=%d load=%u " RBL_LOAD_STR "=%u util=%u",
+		  __entry->cpu, __entry->cgroup_id, __get_str(comm), __entry->pid,
+		  __entry->load, __entry->RBL_LOAD_ENTRY, __entry->util),
+
+	sched_pelt_se_compact_reg, sched_pelt_se_compact_unreg
+);
+
+TRACE_EVENT_FN(sched_util_est_se_compact,
+
+	TP_PROTO(int cpu, u32 cgroup_id, const char *path, char *comm, int pid,
+		 const struct sched_avg *avg),
+
+	TP_ARGS(cpu, cgroup_id, path, comm, pid, avg),
+
+	TP_STRUCT__entry(
+		__field(	u32,		cgroup_id		)
+		__field(	int,		pid			)
+		__field(	u16,		cpu			)
+		__field(	u16,		enqueued		)
+		__field(	u16,		ewma			)
+		__field(	u16,		util			)
+		__string(	comm,		comm			)
+	),
+
+	TP_fast_assign(
+		__entry->cgroup_id	= cgroup_id;
+		__entry->pid		= pid;
+		__entry->cpu		= cpu;
+		__entry->enqueued	= COMPACT_U16(avg->util_est.enqueued);
+		__entry->ewma		= COMPACT_U16(avg->util_est.ewma);
+		__entry->util		= COMPACT_U16(avg->util_avg);
+		__assign_str(comm, comm);
+	),
+
+	TP_printk("cpu=%u cgroup_id=%u comm=%s pid=%d enqueued=%u ewma=%u util=%u",
+		  __entry->cpu, __entry->cgroup_id, __get_str(comm), __entry->pid,
+		  __entry->enqueued, __entry->ewma, __entry->util),
+
+	sched_util_est_se_compact_reg, sched_util_est_se_compact_unreg
+);
+
+TRACE_EVENT_FN(sched_util_est_cfs_compact,
+
+	TP_PROTO(int cpu, u32 cgroup_id, const char *path,
+		 const struct sched_avg *avg),
+
+	TP_ARGS(cpu, cgroup_id, path, avg),
+
+	TP_STRUCT__entry(
+		__field(	u32,		cgroup_id		)
+		__field(	u16,		cpu			)
+		__field(	u16,		enqueued		)
+		__field(	u16,		ewma			)
+		__field(	u16,		util			)
+	),
+
+	TP_fast_assign(
+		__entry->cgroup_id	= cgroup_id;
+		__entry->cpu		= cpu;
+		__entry->enqueued	= COMPACT_U16(avg->util_est.enqueued);
+		__entry->ewma		= COMPACT_U16(avg->util_est.ewma);
+		__entry->util		= COMPACT_U16(avg->util_avg);
+	),
+
+	TP_printk("cpu=%u cgroup_id=%u enqueued=%u ewma=%u util=%u",
+		  __entry->cpu, __entry->cgroup_id, __entry->enqueued,
+		  __entry->ewma, __entry->util),
+
+	sched_util_est_cfs_compact_reg, sched_util_est_cfs_compact_unreg
 );
 
 #endif /* _SCHED_EVENTS_H */
@@ -1,12 +1,261 @@
 /* SPDX-License-Identifier: GPL-2.0 */
 #include <linux/module.h>
 
+#include <linux/cgroup.h>
+#include <linux/cpumask.h>
+#include <linux/debugfs.h>
+#include <linux/hash.h>
+#include <linux/jhash.h>
+#include <linux/kprobes.h>
+#include <linux/percpu.h>
 #include <linux/sched.h>
+#include <linux/sched/clock.h>
+#include <linux/sched/topology.h>
+#include <linux/seq_file.h>
+#include <linux/workqueue.h>
 #include <trace/events/sched.h>
 
 #define CREATE_TRACE_POINTS
 #include "sched_events.h"
 
+#define PELT_AGGR_BITS		4
+#define PELT_AGGR_WAYS		4
+#define CGROUP_CACHE_BITS	6
+#define CGROUP_ID_BITS		10
+#define CGROUP_ID_PROBES	16
+#define FILTER_PIDS_MAX		16
+#define DECIMATE_BITS		6
+#define HIST_BUCKETS		16
+#define HIST_BUCKET_WIDTH	(SCHED_CAPACITY_SCALE / HIST_BUCKETS)
+
+static unsigned int aggr_window_us = 10000;
+module_param(aggr_window_us, uint, 0644);
+MODULE_PARM_DESC(aggr_window_us,
+		 "Length of the window summarized by sched_pelt_*_aggr events (us)");
+
+static int filter_pids[FILTER_PIDS_MAX];
+static int filter_pids_nr;
+module_param_array(filter_pids, int, &filter_pids_nr, 0644);
+MODULE_PARM_DESC(filter_pids, "Only trace the tasks with one of these pids");
+
+static char filter_comm[TASK_COMM_LEN];
+
+static int filter_comm_set(const char *val, const struct kernel_param *kp)
+{
+	strlcpy(filter_comm, val, TASK_COMM_LEN);
+	strreplace(filter_comm, '\n', '\0');
+
+	return 0;
+}
+
+static int filter_comm_get(char *buffer, const struct kernel_param *kp)
+{
+	return scnprintf(buffer, PAGE_SIZE, "%s\n", filter_comm);
+}
+
+static const struct kernel_param_ops filter_comm_ops = {
+	.set = filter_comm_set,
+	.get = filter_comm_get,
+};
+
+module_param_cb(filter_comm, &filter_comm_ops, NULL, 0644);
+MODULE_PARM_DESC(filter_comm, "Only trace the tasks whose comm starts with this prefix");
+
+static unsigned int filter_cgroup;
+module_param(filter_cgroup, uint, 0644);
+MODULE_PARM_DESC(filter_cgroup,
+		 "Only trace the entities of this cgroup_id, as given by sched_cgroup_path (0 for all)");
+
+static struct cpumask filter_cpus = { CPU_BITS_ALL };
+
+static int filter_cpus_set(const char *val, const struct kernel_param *kp)
+{
+	cpumask_var_t mask;
+	int ret;
+
+	if (!alloc_cpumask_var(&mask, GFP_KERNEL))
+		return -ENOMEM;
+
+	ret = cpulist_parse(val, mask);
+	if (!ret)
+		cpumask_copy(&filter_cpus, mask);
+
+	free_cpumask_var(mask);
+	return ret;
+}
+
+static int filter_cpus_get(char *buffer, const struct kernel_param *kp)
+{
+	return scnprintf(buffer, PAGE_SIZE, "%*pbl\n",
+			 cpumask_pr_args(&filter_cpus));
+}
+
+static const struct kernel_param_ops filter_cpus_ops = {
+	.set = filter_cpus_set,
+	.get = filter_cpus_get,
+};
+
+module_param_cb(filter_cpus, &filter_cpus_ops, NULL, 0644);
+MODULE_PARM_DESC(filter_cpus, "Only trace the entities of these CPUs (cpulist)");
+
+static bool stats_enable;
+module_param(stats_enable, bool, 0644);
+MODULE_PARM_DESC(stats_enable,
+		 "Account for the overhead of the module in <debugfs>/sched_tp/stats");
+
+enum sched_tp_handler {
+	SCHED_TP_PELT_CFS,
+	SCHED_TP_PELT_RT,
+	SCHED_TP_PELT_DL,
+	SCHED_TP_PELT_IRQ,
+	SCHED_TP_PELT_SE,
+	SCHED_TP_OVERUTILIZED,
+	SCHED_TP_UTIL_EST_CFS,
+	SCHED_TP_UTIL_EST_SE,
+	NR_SCHED_TP_HANDLERS,
+};
+
+static const char * const sched_tp_handler_names[] = {
+	[SCHED_TP_PELT_CFS]	= "pelt_cfs",
+	[SCHED_TP_PELT_RT]	= "pelt_rt",
+	[SCHED_TP_PELT_DL]	= "pelt_dl",
+	[SCHED_TP_PELT_IRQ]	= "pelt_irq",
+	[SCHED_TP_PELT_SE]	= "pelt_se",
+	[SCHED_TP_OVERUTILIZED]	= "overutilized",
+	[SCHED_TP_UTIL_EST_CFS]	= "util_est_cfs",
+	[SCHED_TP_UTIL_EST_SE]	= "util_est_se",
+};
+
+/* Overhead of each probe, on the CPU it ran on */
+struct sched_tp_stats {
+	u64 hits[NR_SCHED_TP_HANDLERS];
+	u64 time[NR_SCHED_TP_HANDLERS];
+	u64 filtered[NR_SCHED_TP_HANDLERS];
+	u64 decimated[NR_SCHED_TP_HANDLERS];
+};
+
+static DEFINE_PER_CPU(struct sched_tp_stats, sched_tp_stats);
+
+#define stats_inc(counter, handler)						\
+	do {									\
+		if (READ_ONCE(stats_enable))					\
+			this_cpu_inc(sched_tp_stats.counter[handler]);		\
+	} while (0)
+
+/*
+ * Per-CPU decimation state of an event, indexed by a hash of the entity.
+ * Entities sharing a slot share their state, which only makes the decimation
+ * less regular.
+ */
+struct decimate_state {
+	unsigned int		count;
+	u64			last;
+};
+
+struct decimate_table {
+	struct decimate_state slots[1 << DECIMATE_BITS];
+};
+
+#define DEFINE_DECIMATION(event, handler)					\
+	static const enum sched_tp_handler event##_handler = handler;		\
+	static unsigned int event##_every;					\
+	module_param(event##_every, uint, 0644);				\
+	MODULE_PARM_DESC(event##_every,						\
+			 "Only trace one " #event " update out of N per entity");	\
+	static unsigned int event##_period_us;					\
+	module_param(event##_period_us, uint, 0644);				\
+	MODULE_PARM_DESC(event##_period_us,					\
+			 "Only trace one " #event " update per T us per entity");	\
+	static DEFINE_PER_CPU(struct decimate_table, event##_decimate)
+
+#define decimate(event, key)							\
+	__decimate(this_cpu_ptr(&event##_decimate), key,			\
+		   READ_ONCE(event##_every), READ_ONCE(event##_period_us),	\
+		   event##_handler)
+
+DEFINE_DECIMATION(pelt_cfs, SCHED_TP_PELT_CFS);
+DEFINE_DECIMATION(pelt_rt, SCHED_TP_PELT_RT);
+DEFINE_DECIMATION(pelt_dl, SCHED_TP_PELT_DL);
+DEFINE_DECIMATION(pelt_irq, SCHED_TP_PELT_IRQ);
+DEFINE_DECIMATION(pelt_se, SCHED_TP_PELT_SE);
+
+/*
+ * Per-CPU accumulators of an aggregated event, in sets of PELT_AGGR_WAYS
+ * indexed by a hash of the entity, so that a few entities colliding on the
+ * same set do not keep cutting each other's windows short.
+ */
+struct pelt_aggr_table {
+	struct pelt_aggr sets[1 << PELT_AGGR_BITS][PELT_AGGR_WAYS];
+};
+
+static DEFINE_PER_CPU(struct pelt_aggr_table, pelt_cfs_aggr);
+static DEFINE_PER_CPU(struct pelt_aggr_table, pelt_se_aggr);
+
+static bool hist_enable;
+
+/* Histograms of the task signals, indexed by the CPU doing the update */
+struct sched_tp_hist {
+	u64 util[HIST_BUCKETS];
+	u64 runnable[HIST_BUCKETS];
+	u64 ewma[HIST_BUCKETS];
+};
+
+static DEFINE_PER_CPU(struct sched_tp_hist, sched_tp_hist);
+
+static struct dentry *sched_tp_debugfs;
+
+/*
+ * Formatting the path of a cfs_rq is the most expensive part of the PELT
+ * events, so it is done once per cfs_rq and cached along with the numeric id
+ * of that path. The whole cache is invalidated by bumping the generation
+ * whenever a cgroup is created, renamed or destroyed.
+ */
+struct cgroup_cache_entry {
+	const struct cfs_rq	*cfs_rq;
+	unsigned int		gen;
+	u32			id;
+	char			path[PATH_SIZE];
+};
+
+struct cgroup_cache {
+	struct cgroup_cache_entry slots[1 << CGROUP_CACHE_BITS];
+};
+
+static DEFINE_PER_CPU(struct cgroup_cache, cgroup_cache);
+static atomic_t cgroup_cache_gen = ATOMIC_INIT(1);
+
+/*
+ * Cgroup ids are allocated sequentially from a table keyed by path, so that
+ * two paths never share an id. Ids are never freed, which makes them unique
+ * within one load of the module only: they depend on the order in which the
+ * paths are first seen. 0 is the id of "(null)", 1 the one of "/" and
+ * CGROUP_ID_NONE is used for the paths that find no free slot within
+ * CGROUP_ID_PROBES of their hash. Bounding the probes keeps the lookups of
+ * the cache refills short even once the table is (nearly) full: since no
+ * entry is ever removed, a path that has an id is always found within them.
+ */
+#define CGROUP_ID_NULL		0
+#define CGROUP_ID_ROOT		1
+#define CGROUP_ID_NONE		U32_MAX
+
+struct cgroup_id_entry {
+	u32			id;
+	char			path[PATH_SIZE];
+};
+
+static struct cgroup_id_entry cgroup_ids[1 << CGROUP_ID_BITS];
+static u32 cgroup_ids_nr;
+static DEFINE_RAW_SPINLOCK(cgroup_ids_lock);
+
+static const char * const cgroup_tp_names[] = {
+	"cgroup_mkdir",
+	"cgroup_rmdir",
+	"cgroup_rename",
+	"cgroup_release",
+};
+
+static struct tracepoint *cgroup_tps[ARRAY_SIZE(cgroup_tp_names)];
+
 static inline struct cfs_rq *get_group_cfs_rq(struct sched_entity *se)
 {
 #ifdef CONFIG_FAIR_GROUP_SCHED
@@ -25,50 +274,504 @@ static inline struct cfs_rq *get_se_cfs_rq(struct sched_entity *se)
 #endif
 }
 
+static void cgroup_cache_invalidate(void *data, struct cgroup *cgrp,
+				    const char *path)
+{
+	atomic_inc(&cgroup_cache_gen);
+}
+
+static void cgroup_tp_lookup(struct tracepoint *tp, void *priv)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(cgroup_tp_names); i++) {
+		if (!strcmp(tp->name, cgroup_tp_names[i]))
+			cgroup_tps[i] = tp;
+	}
+}
+
+static void cgroup_cache_register(void)
+{
+	int i;
+
+	for_each_kernel_tracepoint(cgroup_tp_lookup, NULL);
+
+	for (i = 0; i < ARRAY_SIZE(cgroup_tps); i++) {
+		if (!cgroup_tps[i] ||
+		    tracepoint_probe_register(cgroup_tps[i],
+					      (void *)cgroup_cache_invalidate,
+					      NULL)) {
+			pr_warn("sched_tp: %s not found, cgroup paths may be stale\n",
+				cgroup_tp_names[i]);
+			cgroup_tps[i] = NULL;
+		}
+	}
+}
+
+static void cgroup_cache_unregister(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(cgroup_tps); i++) {
+		if (cgroup_tps[i])
+			tracepoint_probe_unregister(cgroup_tps[i],
+						    (void *)cgroup_cache_invalidate,
+						    NULL);
+	}
+}
+
+/*
+ * Return the id of @path, allocating one if it is seen for the first time.
+ * This is only called when filling the cgroup cache, so the lock is not taken
+ * on the fast path.
+ */
+static u32 cgroup_id_get(const char *path)
+{
+	u32 hash = jhash(path, strnlen(path, PATH_SIZE), 0);
+	struct cgroup_id_entry *entry;
+	u32 id = CGROUP_ID_NONE;
+	unsigned long flags;
+	int i;
+
+	raw_spin_lock_irqsave(&cgroup_ids_lock, flags);
+	for (i = 0; i < CGROUP_ID_PROBES; i++) {
+		entry = &cgroup_ids[(hash + i) & (ARRAY_SIZE(cgroup_ids) - 1)];
+		if (!entry->id) {
+			entry->id = ++cgroup_ids_nr;
+			strlcpy(entry->path, path, PATH_SIZE);
+		} else if (strncmp(entry->path, path, PATH_SIZE)) {
+			continue;
+		}
+		id = entry->id;
+		break;
+	}
+	raw_spin_unlock_irqrestore(&cgroup_ids_lock, flags);
+
+	if (id == CGROUP_ID_NONE)
+		pr_warn_once("sched_tp: too many cgroups, some will have no id\n");
+
+	return id;
+}
+
+/*
+ * Return the cached path and id of @cfs_rq, (re)filling the entry and
+ * emitting sched_cgroup_path if needed. A NULL @cfs_rq (e.g. the group of a
+ * task entity) has id CGROUP_ID_NULL and path "(null)".
+ */
+static const struct cgroup_cache_entry *cfs_rq_cgroup(struct cfs_rq *cfs_rq)
+{
+	struct cgroup_cache *cache = this_cpu_ptr(&cgroup_cache);
+	struct cgroup_cache_entry *entry;
+	unsigned int gen = atomic_read(&cgroup_cache_gen);
+
+	entry = &cache->slots[hash_ptr(cfs_rq, CGROUP_CACHE_BITS)];
+	if (entry->cfs_rq == cfs_rq && entry->gen == gen)
+		return entry;
+
+	sched_trace_cfs_rq_path(cfs_rq, entry->path, PATH_SIZE);
+	entry->id = cfs_rq ? cgroup_id_get(entry->path) : CGROUP_ID_NULL;
+	entry->cfs_rq = cfs_rq;
+	entry->gen = gen;
+
+	if (cfs_rq)
+		trace_sched_cgroup_path(entry->id, entry->path);
+
+	return entry;
+}
+
+static inline bool filter_cpu(int cpu)
+{
+	return cpu < 0 || cpumask_test_cpu(cpu, &filter_cpus);
+}
+
+static inline bool filter_task(struct task_struct *p)
+{
+	size_t comm_len = strlen(filter_comm);
+	int nr = READ_ONCE(filter_pids_nr);
+	int i;
+
+	if (!nr && !comm_len)
+		return true;
+
+	/* Group entities are never matched by task filters */
+	if (!p)
+		return false;
+
+	if (comm_len && strncmp(p->comm, filter_comm, comm_len))
+		return false;
+
+	if (!nr)
+		return true;
+
+	for (i = 0; i < nr; i++) {
+		if (filter_pids[i] == p->pid)
+			return true;
+	}
+
+	return false;
+}
+
+static inline bool filter_cgroup_id(struct cfs_rq *cfs_rq)
+{
+	unsigned int id = READ_ONCE(filter_cgroup);
+
+	return !id || cfs_rq_cgroup(cfs_rq)->id == id;
+}
+
+/*
+ * The filters are evaluated before anything is copied out of the entity. A
+ * group entity is matched by the cgroup it represents, a task by the cgroup
+ * it belongs to.
+ */
+static bool filter_cfs_rq(struct cfs_rq *cfs_rq)
+{
+	return filter_cpu(sched_trace_cfs_rq_cpu(cfs_rq)) &&
+	       filter_cgroup_id(cfs_rq);
+}
+
+static bool filter_se(struct sched_entity *se)
+{
+	struct cfs_rq *gcfs_rq = get_group_cfs_rq(se);
+	struct task_struct *p;
+
+	p = gcfs_rq ? NULL : container_of(se, struct task_struct, se);
+
+	return filter_cpu(sched_trace_cfs_rq_cpu(get_se_cfs_rq(se))) &&
+	       filter_task(p) &&
+	       filter_cgroup_id(gcfs_rq ?: get_se_cfs_rq(se));
+}
+
+/*
+ * Return true if the update of @key should be dropped, i.e. if less than
+ * @every updates or less than @period_us have elapsed since the last one that
+ * was traced. Both are disabled when 0.
+ */
+static inline bool __decimate(struct decimate_table *table, const void *key,
+			      unsigned int every, unsigned int period_us,
+			      enum sched_tp_handler handler)
+{
+	struct decimate_state *state;
+	u64 now;
+
+	if (every <= 1 && !period_us)
+		return false;
+
+	state = &table->slots[hash_ptr((void *)key, DECIMATE_BITS)];
+
+	if (every > 1 && ++state->count < every)
+		goto drop;
+	state->count = 0;
+
+	if (period_us) {
+		now = local_clock();
+		if (now - state->last < (u64)period_us * NSEC_PER_USEC)
+			goto drop;
+		state->last = now;
+	}
+
+	return false;
+
+drop:
+	stats_inc(decimated, handler);
+	return true;
+}
+
 static inline void _trace_cfs(struct cfs_rq *cfs_rq,
-			      void (*trace_event)(int, char*,
+			      void (*trace_event)(int, u32, const char*,
 						  const struct sched_avg*))
 {
+	const struct cgroup_cache_entry *cgrp;
 	const struct sched_avg *avg;
-	char path[PATH_SIZE];
 	int cpu;
 
 	avg = sched_trace_cfs_rq_avg(cfs_rq);
-	sched_trace_cfs_rq_path(cfs_rq, path, PATH_SIZE);
+	cgrp = cfs_rq_cgroup(cfs_rq);
 	cpu = sched_trace_cfs_rq_cpu(cfs_rq);
 
-	trace_event(cpu, path, avg);
+	trace_event(cpu, cgrp->id, cgrp->path, avg);
  }
 
 static inline void _trace_se(struct sched_entity *se,
-			     void (*trace_event)(int, char*, char*, int,
+			     void (*trace_event)(int, u32, const char*, char*, int,
 						 const struct sched_avg*))
 {
 	void *gcfs_rq = get_group_cfs_rq(se);
 	void *cfs_rq = get_se_cfs_rq(se);
+	const struct cgroup_cache_entry *cgrp;
 	struct task_struct *p;
-	char path[PATH_SIZE];
 	char *comm;
 	pid_t pid;
 	int cpu;
 
-	sched_trace_cfs_rq_path(gcfs_rq, path, PATH_SIZE);
+	cgrp = cfs_rq_cgroup(gcfs_rq);
 	cpu = sched_trace_cfs_rq_cpu(cfs_rq);
 
 	p = gcfs_rq ? NULL : container_of(se, struct task_struct, se);
 	comm = p ? p->comm : "(null)";
 	pid = p ? p->pid : -1;
 
-	trace_event(cpu, path, comm, pid, &se->avg);
+	trace_event(cpu, cgrp->id, cgrp->path, comm, pid, &se->avg);
+}
+
+static inline void pelt_stat_add(struct pelt_stat *stat, unsigned long val,
+				 bool first)
+{
+	if (first) {
+		stat->min = val;
+		stat->max = val;
+	} else {
+		stat->min = min(stat->min, val);
+		stat->max = max(stat->max, val);
+	}
+	stat->last = val;
+}
+
+static inline void pelt_aggr_add(struct pelt_aggr *aggr,
+				 const struct sched_avg *avg)
+{
+	bool first = !aggr->nr++;
+
+	pelt_stat_add(&aggr->load, avg->load_avg, first);
+	pelt_stat_add(&aggr->runnable, avg->RBL_LOAD_MEMBER, first);
+	pelt_stat_add(&aggr->util, avg->util_avg, first);
+}
+
+static void pelt_aggr_flush(struct pelt_aggr *aggr,
+			    void (*trace_event)(const struct pelt_aggr*))
+{
+	if (aggr->nr)
+		trace_event(aggr);
+
+	aggr->nr = 0;
+	aggr->evicted = false;
+}
+
+/*
+ * Return the accumulator of @key on this CPU, emitting the summary of the
+ * previous window first if it has expired. When @key has no accumulator yet,
+ * an idle one of its set is used, or else the least recently updated one is
+ * evicted, flushing its window early. @key is only ever compared, it may
+ * point to a freed entity.
+ */
+static struct pelt_aggr *pelt_aggr_get(struct pelt_aggr_table *table,
+				       const void *key,
+				       void (*trace_event)(const struct pelt_aggr*))
+{
+	struct pelt_aggr *set = table->sets[hash_ptr((void *)key, PELT_AGGR_BITS)];
+	u64 window = (u64)READ_ONCE(aggr_window_us) * NSEC_PER_USEC;
+	u64 now = local_clock();
+	struct pelt_aggr *aggr;
+	int i;
+
+	for (i = 0; i < PELT_AGGR_WAYS; i++) {
+		if (set[i].key == key) {
+			aggr = &set[i];
+			goto found;
+		}
+	}
+
+	aggr = &set[0];
+	for (i = 1; i < PELT_AGGR_WAYS && aggr->nr; i++) {
+		if (!set[i].nr || set[i].last_update < aggr->last_update)
+			aggr = &set[i];
+	}
+
+	if (aggr->nr && now - aggr->start < window)
+		aggr->evicted = true;
+	pelt_aggr_flush(aggr, trace_event);
+	aggr->key = key;
+
+found:
+	if (now - aggr->start >= window)
+		pelt_aggr_flush(aggr, trace_event);
+	if (!aggr->nr)
+		aggr->start = now;
+	aggr->last_update = now;
+
+	return aggr;
+}
+
+static void pelt_aggr_flush_all(struct pelt_aggr_table __percpu *tables,
+				void (*trace_event)(const struct pelt_aggr*))
+{
+	int cpu, i, j;
+
+	for_each_possible_cpu(cpu) {
+		struct pelt_aggr_table *table = per_cpu_ptr(tables, cpu);
+
+		for (i = 0; i < ARRAY_SIZE(table->sets); i++) {
+			for (j = 0; j < PELT_AGGR_WAYS; j++)
+				pelt_aggr_flush(&table->sets[i][j], trace_event);
+		}
+	}
+}
+
+static inline void _aggr_cfs(struct cfs_rq *cfs_rq)
+{
+	struct pelt_aggr *aggr;
+
+	aggr = pelt_aggr_get(this_cpu_ptr(&pelt_cfs_aggr), cfs_rq,
+			     trace_sched_pelt_cfs_aggr);
+	if (!aggr->nr) {
+		const struct cgroup_cache_entry *cgrp = cfs_rq_cgroup(cfs_rq);
+
+		aggr->cpu = sched_trace_cfs_rq_cpu(cfs_rq);
+		aggr->cgroup_id = cgrp->id;
+		strlcpy(aggr->path, cgrp->path, PATH_SIZE);
+	}
+
+	pelt_aggr_add(aggr, sched_trace_cfs_rq_avg(cfs_rq));
+}
+
+static inline void _aggr_se(struct sched_entity *se)
+{
+	struct pelt_aggr *aggr;
+
+	aggr = pelt_aggr_get(this_cpu_ptr(&pelt_se_aggr), se,
+			     trace_sched_pelt_se_aggr);
+	if (!aggr->nr) {
+		void *gcfs_rq = get_group_cfs_rq(se);
+		const struct cgroup_cache_entry *cgrp = cfs_rq_cgroup(gcfs_rq);
+		struct task_struct *p;
+
+		p = gcfs_rq ? NULL : container_of(se, struct task_struct, se);
+
+		aggr->cpu = sched_trace_cfs_rq_cpu(get_se_cfs_rq(se));
+		aggr->pid = p ? p->pid : -1;
+		aggr->cgroup_id = cgrp->id;
+		strlcpy(aggr->comm, p ? p->comm : "(null)", TASK_COMM_LEN);
+		strlcpy(aggr->path, cgrp->path, PATH_SIZE);
+	}
+
+	pelt_aggr_add(aggr, &se->avg);
+}
+
+static inline unsigned int hist_bucket(unsigned long val)
+{
+	return min_t(unsigned long, val / HIST_BUCKET_WIDTH, HIST_BUCKETS - 1);
+}
+
+/*
+ * Up to 5.6, runnable_load_avg is scaled by the weight of the entity like
+ * load_avg is. Divide the weight back out so that the runnable histogram is
+ * in capacity units on all kernels, like util_avg. On 64-bit, load.weight
+ * carries the extra fixed point resolution that scale_load_down() removes in
+ * kernel/sched/sched.h.
+ */
+static inline unsigned long hist_runnable(struct sched_entity *se)
+{
+#if LINUX_VERSION_CODE <= KERNEL_VERSION(5,6,0)
+#ifdef CONFIG_64BIT
+	unsigned long weight = se->load.weight >> SCHED_FIXEDPOINT_SHIFT;
+#else
+	unsigned long weight = se->load.weight;
+#endif
+
+	weight = max(weight, 1UL);
+
+	return se->avg.runnable_load_avg * SCHED_CAPACITY_SCALE / weight;
+#else
+	return se->avg.runnable_avg;
+#endif
+}
+
+static inline void hist_se(struct sched_entity *se)
+{
+	if (!READ_ONCE(hist_enable) || get_group_cfs_rq(se))
+		return;
+
+	this_cpu_inc(sched_tp_hist.util[hist_bucket(se->avg.util_avg)]);
+	this_cpu_inc(sched_tp_hist.runnable[hist_bucket(hist_runnable(se))]);
+}
+
+static inline void hist_util_est_se(struct sched_entity *se)
+{
+	if (!READ_ONCE(hist_enable) || get_group_cfs_rq(se))
+		return;
+
+	this_cpu_inc(sched_tp_hist.ewma[hist_bucket(se->avg.util_est.ewma)]);
+}
+
+static void hist_show_signal(struct seq_file *m, const char *name,
+			     size_t offset)
+{
+	int cpu, i;
+
+	for_each_possible_cpu(cpu) {
+		const u64 *buckets = (void *)per_cpu_ptr(&sched_tp_hist, cpu) + offset;
+
+		seq_printf(m, "%s %d", name, cpu);
+		for (i = 0; i < HIST_BUCKETS; i++)
+			seq_printf(m, " %llu", buckets[i]);
+		seq_putc(m, '\n');
+	}
+}
+
+static int hist_show(struct seq_file *m, void *v)
+{
+	int i;
+
+	/* All the signals are in capacity units, out of SCHED_CAPACITY_SCALE */
+	seq_printf(m, "# units: capacity, scale=%ld\n", SCHED_CAPACITY_SCALE);
+	seq_puts(m, "# signal cpu");
+	for (i = 0; i < HIST_BUCKETS; i++)
+		seq_printf(m, " %ld", i * HIST_BUCKET_WIDTH);
+	seq_putc(m, '\n');
+
+	hist_show_signal(m, "util", offsetof(struct sched_tp_hist, util));
+	hist_show_signal(m, "runnable", offsetof(struct sched_tp_hist, runnable));
+	hist_show_signal(m, "ewma", offsetof(struct sched_tp_hist, ewma));
+
+	return 0;
+}
+
+static int hist_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, hist_show, NULL);
 }
 
-static void sched_pelt_cfs(void *data, struct cfs_rq *cfs_rq)
+/* Writing anything resets the histograms */
+static ssize_t hist_write(struct file *file, const char __user *buf,
+			  size_t count, loff_t *ppos)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(&sched_tp_hist, cpu), 0,
+		       sizeof(struct sched_tp_hist));
+
+	return count;
+}
+
+static const struct file_operations hist_fops = {
+	.owner		= THIS_MODULE,
+	.open		= hist_open,
+	.read		= seq_read,
+	.write		= hist_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static inline void __sched_pelt_cfs(struct cfs_rq *cfs_rq)
 {
-	if (trace_sched_pelt_cfs_enabled())
-		_trace_cfs(cfs_rq, trace_sched_pelt_cfs);
+	if (!filter_cfs_rq(cfs_rq)) {
+		stats_inc(filtered, SCHED_TP_PELT_CFS);
+		return;
+	}
+
+	if (!decimate(pelt_cfs, cfs_rq)) {
+		if (trace_sched_pelt_cfs_enabled())
+			_trace_cfs(cfs_rq, trace_sched_pelt_cfs);
+
+		if (trace_sched_pelt_cfs_compact_enabled())
+			_trace_cfs(cfs_rq, trace_sched_pelt_cfs_compact);
+	}
+
+	if (trace_sched_pelt_cfs_aggr_enabled())
+		_aggr_cfs(cfs_rq);
 }
 
-static void sched_pelt_rt(void *data, struct rq *rq)
+static inline void __sched_pelt_rt(struct rq *rq)
 {
 	if (trace_sched_pelt_rt_enabled()) {
 		const struct sched_avg *avg = sched_trace_rq_avg_rt(rq);
@@ -77,11 +780,19 @@ static void sched_pelt_rt(void *data, struct rq *rq)
 		if (!avg)
 			return;
 
+		if (!filter_cpu(cpu)) {
+			stats_inc(filtered, SCHED_TP_PELT_RT);
+			return;
+		}
+
+		if (decimate(pelt_rt, rq))
+			return;
+
 		trace_sched_pelt_rt(cpu, avg);
 	}
 }
 
-static void sched_pelt_dl(void *data, struct rq *rq)
+static inline void __sched_pelt_dl(struct rq *rq)
 {
 	if (trace_sched_pelt_dl_enabled()) {
 		const struct sched_avg *avg = sched_trace_rq_avg_dl(rq);
@@ -90,11 +801,19 @@ static void sched_pelt_dl(void *data, struct rq *rq)
 		if (!avg)
 			return;
 
+		if (!filter_cpu(cpu)) {
+			stats_inc(filtered, SCHED_TP_PELT_DL);
+			return;
+		}
+
+		if (decimate(pelt_dl, rq))
+			return;
+
 		trace_sched_pelt_dl(cpu, avg);
 	}
 }
 
-static void sched_pelt_irq(void *data, struct rq *rq)
+static inline void __sched_pelt_irq(struct rq *rq)
 {
 	if (trace_sched_pelt_irq_enabled()){
 		const struct sched_avg *avg = sched_trace_rq_avg_irq(rq);
@@ -103,64 +822,482 @@ static void sched_pelt_irq(void *data, struct rq *rq)
 		if (!avg)
 			return;
 
+		if (!filter_cpu(cpu)) {
+			stats_inc(filtered, SCHED_TP_PELT_IRQ);
+			return;
+		}
+
+		if (decimate(pelt_irq, rq))
+			return;
+
 		trace_sched_pelt_irq(cpu, avg);
 	}
 }
 
-static void sched_pelt_se(void *data, struct sched_entity *se)
+static inline void __sched_pelt_se(struct sched_entity *se)
 {
-	if (trace_sched_pelt_se_enabled()) {
-		_trace_se(se, trace_sched_pelt_se);
+	if (!filter_se(se)) {
+		stats_inc(filtered, SCHED_TP_PELT_SE);
+		return;
 	}
-}
 
-static void sched_overutilized(void *data, struct root_domain *rd, bool overutilized)
-{
-	if (trace_sched_overutilized_enabled()) {
-		char span[SPAN_SIZE];
+	hist_se(se);
 
-		cpumap_print_to_pagebuf(false, span, sched_trace_rd_span(rd));
+	if (!decimate(pelt_se, se)) {
+		if (trace_sched_pelt_se_enabled())
+			_trace_se(se, trace_sched_pelt_se);
 
-		trace_sched_overutilized(overutilized, span);
+		if (trace_sched_pelt_se_compact_enabled())
+			_trace_se(se, trace_sched_pelt_se_compact);
 	}
+
+	if (trace_sched_pelt_se_aggr_enabled())
+		_aggr_se(se);
+}
+
+static inline void __sched_overutilized(struct root_domain *rd, bool overutilized)
+{
+	if (trace_sched_overutilized_enabled())
+		trace_sched_overutilized(overutilized, sched_trace_rd_span(rd));
 }
 
-static void sched_util_est_cfs(void *data, struct cfs_rq *cfs_rq)
+static inline void __sched_util_est_cfs(struct cfs_rq *cfs_rq)
 {
+	if (!filter_cfs_rq(cfs_rq)) {
+		stats_inc(filtered, SCHED_TP_UTIL_EST_CFS);
+		return;
+	}
+
 	if (trace_sched_util_est_cfs_enabled())
 		_trace_cfs(cfs_rq, trace_sched_util_est_cfs);
+
+	if (trace_sched_util_est_cfs_compact_enabled())
+		_trace_cfs(cfs_rq, trace_sched_util_est_cfs_compact);
 }
 
-static void sched_util_est_se(void *data, struct sched_entity *se)
+static inline void __sched_util_est_se(struct sched_entity *se)
 {
+	if (!filter_se(se)) {
+		stats_inc(filtered, SCHED_TP_UTIL_EST_SE);
+		return;
+	}
+
+	hist_util_est_se(se);
+
 	if (trace_sched_util_est_se_enabled())
 		_trace_se(se, trace_sched_util_est_se);
+
+	if (trace_sched_util_est_se_compact_enabled())
+		_trace_se(se, trace_sched_util_est_se_compact);
+}
+
+/*
+ * Define the probe @name calling __@name(), accounting for its hits and for
+ * the time spent in it when stats_enable is set.
+ */
+#define DEFINE_PROBE(name, handler, proto, args)				\
+	static void name(void *data, proto)					\
+	{									\
+		u64 start;							\
+										\
+		if (!READ_ONCE(stats_enable)) {					\
+			__##name(args);						\
+			return;							\
+		}								\
+										\
+		start = local_clock();						\
+		__##name(args);							\
+		this_cpu_inc(sched_tp_stats.hits[handler]);			\
+		this_cpu_add(sched_tp_stats.time[handler], local_clock() - start); \
+	}
+
+DEFINE_PROBE(sched_pelt_cfs, SCHED_TP_PELT_CFS,
+	     PARAMS(struct cfs_rq *cfs_rq), PARAMS(cfs_rq))
+DEFINE_PROBE(sched_pelt_rt, SCHED_TP_PELT_RT,
+	     PARAMS(struct rq *rq), PARAMS(rq))
+DEFINE_PROBE(sched_pelt_dl, SCHED_TP_PELT_DL,
+	     PARAMS(struct rq *rq), PARAMS(rq))
+DEFINE_PROBE(sched_pelt_irq, SCHED_TP_PELT_IRQ,
+	     PARAMS(struct rq *rq), PARAMS(rq))
+DEFINE_PROBE(sched_pelt_se, SCHED_TP_PELT_SE,
+	     PARAMS(struct sched_entity *se), PARAMS(se))
+DEFINE_PROBE(sched_overutilized, SCHED_TP_OVERUTILIZED,
+	     PARAMS(struct root_domain *rd, bool overutilized),
+	     PARAMS(rd, overutilized))
+DEFINE_PROBE(sched_util_est_cfs, SCHED_TP_UTIL_EST_CFS,
+	     PARAMS(struct cfs_rq *cfs_rq), PARAMS(cfs_rq))
+DEFINE_PROBE(sched_util_est_se, SCHED_TP_UTIL_EST_SE,
+	     PARAMS(struct sched_entity *se), PARAMS(se))
+
+static int stats_show(struct seq_file *m, void *v)
+{
+	int cpu, i;
+
+	seq_puts(m, "# handler cpu hits time_ns filtered decimated\n");
+
+	for (i = 0; i < NR_SCHED_TP_HANDLERS; i++) {
+		for_each_possible_cpu(cpu) {
+			const struct sched_tp_stats *stats = per_cpu_ptr(&sched_tp_stats, cpu);
+
+			seq_printf(m, "%s %d %llu %llu %llu %llu\n",
+				   sched_tp_handler_names[i], cpu,
+				   stats->hits[i], stats->time[i],
+				   stats->filtered[i], stats->decimated[i]);
+		}
+	}
+
+	return 0;
+}
+
+static int stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, stats_show, NULL);
 }
 
+/* Writing anything resets the counters */
+static ssize_t stats_write(struct file *file, const char __user *buf,
+			   size_t count, loff_t *ppos)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(&sched_tp_stats, cpu), 0,
+		       sizeof(struct sched_tp_stats));
+
+	return count;
+}
+
+static const struct file_operations stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= stats_open,
+	.read		= seq_read,
+	.write		= stats_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+#ifdef CONFIG_KRETPROBES
+/*
+ * There is no tracepoint in the wakeup path, so the placement decisions are
+ * traced with kretprobes. find_energy_efficient_cpu() is static and might be
+ * inlined, in which case only sched_select_task_rq is available.
+ */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5,10,0)
+#define SELECT_RQ_WAKE_FLAGS_ARG	3
+#else
+#define SELECT_RQ_WAKE_FLAGS_ARG	2
+#endif
+
+struct select_rq_data {
+	struct task_struct	*p;
+	u64			start;
+	int			prev_cpu;
+	int			wake_flags;
+};
+
+static int select_rq_entry(struct kretprobe_instance *ri, struct pt_regs *regs)
+{
+	struct select_rq_data *data = (void *)ri->data;
+	struct task_struct *p = (void *)regs_get_kernel_argument(regs, 0);
+
+	/* A non-zero return skips the return handler */
+	if (!trace_sched_select_task_rq_enabled() || !filter_task(p))
+		return 1;
+
+	data->p = p;
+	data->prev_cpu = regs_get_kernel_argument(regs, 1);
+	data->wake_flags = regs_get_kernel_argument(regs, SELECT_RQ_WAKE_FLAGS_ARG);
+	data->start = local_clock();
+
+	return 0;
+}
+
+static int select_rq_ret(struct kretprobe_instance *ri, struct pt_regs *regs)
+{
+	struct select_rq_data *data = (void *)ri->data;
+	u64 delta = local_clock() - data->start;
+
+	trace_sched_select_task_rq(data->p, data->prev_cpu,
+				   regs_return_value(regs), data->wake_flags,
+				   delta);
+	return 0;
+}
+
+static int feec_entry(struct kretprobe_instance *ri, struct pt_regs *regs)
+{
+	struct select_rq_data *data = (void *)ri->data;
+	struct task_struct *p = (void *)regs_get_kernel_argument(regs, 0);
+
+	if (!trace_sched_find_energy_efficient_cpu_enabled() || !filter_task(p))
+		return 1;
+
+	data->p = p;
+	data->prev_cpu = regs_get_kernel_argument(regs, 1);
+	data->start = local_clock();
+
+	return 0;
+}
+
+static int feec_ret(struct kretprobe_instance *ri, struct pt_regs *regs)
+{
+	struct select_rq_data *data = (void *)ri->data;
+	u64 delta = local_clock() - data->start;
+
+	trace_sched_find_energy_efficient_cpu(data->p, data->prev_cpu,
+					      regs_return_value(regs), delta);
+	return 0;
+}
+
+static struct kretprobe select_rq_kretprobe = {
+	.kp.symbol_name	= "select_task_rq_fair",
+	.entry_handler	= select_rq_entry,
+	.handler	= select_rq_ret,
+	.data_size	= sizeof(struct select_rq_data),
+};
+
+static struct kretprobe feec_kretprobe = {
+	.kp.symbol_name	= "find_energy_efficient_cpu",
+	.entry_handler	= feec_entry,
+	.handler	= feec_ret,
+	.data_size	= sizeof(struct select_rq_data),
+};
+
+static int sched_kretprobe_register(struct kretprobe *rp)
+{
+	/* Forget the address resolved by a previous registration */
+	rp->kp.addr = NULL;
+	rp->kp.flags = 0;
+
+	return register_kretprobe(rp);
+}
+
+static int select_rq_register(void)
+{
+	return sched_kretprobe_register(&select_rq_kretprobe);
+}
+
+static void select_rq_unregister(void)
+{
+	unregister_kretprobe(&select_rq_kretprobe);
+}
+
+static int feec_register(void)
+{
+	return sched_kretprobe_register(&feec_kretprobe);
+}
+
+static void feec_unregister(void)
+{
+	unregister_kretprobe(&feec_kretprobe);
+}
+#else
+static int select_rq_register(void) { return -ENOSYS; }
+static void select_rq_unregister(void) {}
+static int feec_register(void) { return -ENOSYS; }
+static void feec_unregister(void) {}
+#endif
+
+#define DEFINE_TP_PROBE_REG(probe, tp)						\
+	static int probe##_register(void)					\
+	{									\
+		return register_trace_##tp(probe, NULL);			\
+	}									\
+										\
+	static void probe##_unregister(void)					\
+	{									\
+		unregister_trace_##tp(probe, NULL);				\
+	}
+
+DEFINE_TP_PROBE_REG(sched_pelt_cfs, pelt_cfs_tp)
+DEFINE_TP_PROBE_REG(sched_pelt_rt, pelt_rt_tp)
+DEFINE_TP_PROBE_REG(sched_pelt_dl, pelt_dl_tp)
+DEFINE_TP_PROBE_REG(sched_pelt_irq, pelt_irq_tp)
+DEFINE_TP_PROBE_REG(sched_pelt_se, pelt_se_tp)
+DEFINE_TP_PROBE_REG(sched_overutilized, sched_overutilized_tp)
+DEFINE_TP_PROBE_REG(sched_util_est_cfs, sched_util_est_cfs_tp)
+DEFINE_TP_PROBE_REG(sched_util_est_se, sched_util_est_se_tp)
+
+/*
+ * A probe is only registered while at least one of the events (or features)
+ * it feeds is enabled, so that disabled events cost nothing on the scheduler
+ * paths. Tracepoint probes are indexed by their handler, with the kretprobes
+ * coming after them.
+ */
+enum {
+	SCHED_TP_SELECT_RQ = NR_SCHED_TP_HANDLERS,
+	SCHED_TP_FEEC,
+	NR_SCHED_TP_PROBES,
+};
+
+struct sched_tp_probe {
+	const char	*name;
+	int		(*reg)(void);
+	void		(*unreg)(void);
+	atomic_t	refcount;
+	bool		registered;
+};
+
+#define SCHED_TP_PROBE(probe)							\
+	{									\
+		.name	= #probe,						\
+		.reg	= probe##_register,					\
+		.unreg	= probe##_unregister,					\
+	}
+
+static struct sched_tp_probe sched_tp_probes[NR_SCHED_TP_PROBES] = {
+	[SCHED_TP_PELT_CFS]	= SCHED_TP_PROBE(sched_pelt_cfs),
+	[SCHED_TP_PELT_RT]	= SCHED_TP_PROBE(sched_pelt_rt),
+	[SCHED_TP_PELT_DL]	= SCHED_TP_PROBE(sched_pelt_dl),
+	[SCHED_TP_PELT_IRQ]	= SCHED_TP_PROBE(sched_pelt_irq),
+	[SCHED_TP_PELT_SE]	= SCHED_TP_PROBE(sched_pelt_se),
+	[SCHED_TP_OVERUTILIZED]	= SCHED_TP_PROBE(sched_overutilized),
+	[SCHED_TP_UTIL_EST_CFS]	= SCHED_TP_PROBE(sched_util_est_cfs),
+	[SCHED_TP_UTIL_EST_SE]	= SCHED_TP_PROBE(sched_util_est_se),
+	[SCHED_TP_SELECT_RQ]	= SCHED_TP_PROBE(select_rq),
+	[SCHED_TP_FEEC]		= SCHED_TP_PROBE(feec),
+};
+
+static DEFINE_MUTEX(sched_tp_probes_lock);
+static bool sched_tp_exiting;
+
+static void sched_tp_probes_sync(struct work_struct *work)
+{
+	bool exiting = READ_ONCE(sched_tp_exiting);
+	int i;
+
+	mutex_lock(&sched_tp_probes_lock);
+
+	for (i = 0; i < NR_SCHED_TP_PROBES; i++) {
+		struct sched_tp_probe *probe = &sched_tp_probes[i];
+		bool wanted = !exiting && atomic_read(&probe->refcount) > 0;
+
+		if (wanted && !probe->registered) {
+			if (probe->reg())
+				pr_warn("sched_tp: failed to register the %s probe\n",
+					probe->name);
+			else
+				probe->registered = true;
+		} else if (!wanted && probe->registered) {
+			probe->unreg();
+			probe->registered = false;
+		}
+	}
+
+	mutex_unlock(&sched_tp_probes_lock);
+}
+
+static DECLARE_WORK(sched_tp_probes_work, sched_tp_probes_sync);
+
+/*
+ * The reg/unreg callbacks of the events are called with tracepoints_mutex
+ * held, so the probes cannot be registered from there and this is deferred to
+ * a work item.
+ */
+static void sched_tp_probe_get(int probe)
+{
+	atomic_inc(&sched_tp_probes[probe].refcount);
+
+	if (!READ_ONCE(sched_tp_exiting))
+		schedule_work(&sched_tp_probes_work);
+}
+
+static void sched_tp_probe_put(int probe)
+{
+	atomic_dec(&sched_tp_probes[probe].refcount);
+
+	if (!READ_ONCE(sched_tp_exiting))
+		schedule_work(&sched_tp_probes_work);
+}
+
+#define DEFINE_EVENT_REG(event, probe)						\
+	static int event##_reg(void)						\
+	{									\
+		sched_tp_probe_get(probe);					\
+		return 0;							\
+	}									\
+										\
+	static void event##_unreg(void)						\
+	{									\
+		sched_tp_probe_put(probe);					\
+	}
+
+DEFINE_EVENT_REG(sched_pelt_cfs, SCHED_TP_PELT_CFS)
+DEFINE_EVENT_REG(sched_pelt_cfs_compact, SCHED_TP_PELT_CFS)
+DEFINE_EVENT_REG(sched_pelt_cfs_aggr, SCHED_TP_PELT_CFS)
+DEFINE_EVENT_REG(sched_pelt_rt, SCHED_TP_PELT_RT)
+DEFINE_EVENT_REG(sched_pelt_dl, SCHED_TP_PELT_DL)
+DEFINE_EVENT_REG(sched_pelt_irq, SCHED_TP_PELT_IRQ)
+DEFINE_EVENT_REG(sched_pelt_se, SCHED_TP_PELT_SE)
+DEFINE_EVENT_REG(sched_pelt_se_compact, SCHED_TP_PELT_SE)
+DEFINE_EVENT_REG(sched_pelt_se_aggr, SCHED_TP_PELT_SE)
+DEFINE_EVENT_REG(sched_overutilized, SCHED_TP_OVERUTILIZED)
+DEFINE_EVENT_REG(sched_util_est_cfs, SCHED_TP_UTIL_EST_CFS)
+DEFINE_EVENT_REG(sched_util_est_cfs_compact, SCHED_TP_UTIL_EST_CFS)
+DEFINE_EVENT_REG(sched_util_est_se, SCHED_TP_UTIL_EST_SE)
+DEFINE_EVENT_REG(sched_util_est_se_compact, SCHED_TP_UTIL_EST_SE)
+DEFINE_EVENT_REG(sched_select_task_rq, SCHED_TP_SELECT_RQ)
+DEFINE_EVENT_REG(sched_find_energy_efficient_cpu, SCHED_TP_FEEC)
+
+/* The histograms are fed by the task entities probes */
+static int hist_enable_set(const char *val, const struct kernel_param *kp)
+{
+	bool old = hist_enable;
+	int ret;
+
+	ret = param_set_bool(val, kp);
+	if (ret || hist_enable == old)
+		return ret;
+
+	if (hist_enable) {
+		sched_tp_probe_get(SCHED_TP_PELT_SE);
+		sched_tp_probe_get(SCHED_TP_UTIL_EST_SE);
+	} else {
+		sched_tp_probe_put(SCHED_TP_PELT_SE);
+		sched_tp_probe_put(SCHED_TP_UTIL_EST_SE);
+	}
+
+	return 0;
+}
+
+static const struct kernel_param_ops hist_enable_ops = {
+	.set = hist_enable_set,
+	.get = param_get_bool,
+};
+
+module_param_cb(hist_enable, &hist_enable_ops, &hist_enable, 0644);
+MODULE_PARM_DESC(hist_enable,
+		 "Build per-CPU histograms of task signals in <debugfs>/sched_tp/hist");
+
 static int sched_tp_init(void)
 {
-	register_trace_pelt_cfs_tp(sched_pelt_cfs, NULL);
-	register_trace_pelt_rt_tp(sched_pelt_rt, NULL);
-	register_trace_pelt_dl_tp(sched_pelt_dl, NULL);
-	register_trace_pelt_irq_tp(sched_pelt_irq, NULL);
-	register_trace_pelt_se_tp(sched_pelt_se, NULL);
-	register_trace_sched_overutilized_tp(sched_overutilized, NULL);
-	register_trace_sched_util_est_cfs_tp(sched_util_est_cfs, NULL);
-	register_trace_sched_util_est_se_tp(sched_util_est_se, NULL);
+	sched_tp_debugfs = debugfs_create_dir("sched_tp", NULL);
+	debugfs_create_file("hist", 0644, sched_tp_debugfs, NULL, &hist_fops);
+	debugfs_create_file("stats", 0644, sched_tp_debugfs, NULL, &stats_fops);
+
+	/* Make CGROUP_ID_ROOT the id of the root cgroup */
+	cgroup_id_get("/");
+	cgroup_cache_register();
 
 	return 0;
 }
 
 static void sched_tp_finish(void)
 {
-	unregister_trace_pelt_cfs_tp(sched_pelt_cfs, NULL);
-	unregister_trace_pelt_rt_tp(sched_pelt_rt, NULL);
-	unregister_trace_pelt_dl_tp(sched_pelt_dl, NULL);
-	unregister_trace_pelt_irq_tp(sched_pelt_irq, NULL);
-	unregister_trace_pelt_se_tp(sched_pelt_se, NULL);
-	unregister_trace_sched_overutilized_tp(sched_overutilized, NULL);
-	unregister_trace_sched_util_est_cfs_tp(sched_util_est_cfs, NULL);
-	unregister_trace_sched_util_est_se_tp(sched_util_est_se, NULL);
+	/*
+	 * The events are only disabled once the module is gone, ignore their
+	 * unreg callbacks from now on and unregister all the probes.
+	 */
+	WRITE_ONCE(sched_tp_exiting, true);
+	cancel_work_sync(&sched_tp_probes_work);
+	sched_tp_probes_sync(NULL);
+	cgroup_cache_unregister();
+
+	/* Emit the windows still open, nothing can update them anymore */
+	tracepoint_synchronize_unregister();
+	pelt_aggr_flush_all(&pelt_cfs_aggr, trace_sched_pelt_cfs_aggr);
+	pelt_aggr_flush_all(&pelt_se_aggr, trace_sched_pelt_se_aggr);
+
+	debugfs_remove_recursive(sched_tp_debugfs);
 }
 
 